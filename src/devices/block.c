@@ -3,8 +3,17 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 
+/* Most sectors merged into a single transfer. */
+#define BLOCK_MERGE_MAX 64
+
+/* A bio that has waited this many timer ticks is served next,
+   ahead of the elevator order. */
+#define BLOCK_DEADLINE_TICKS (TIMER_FREQ / 2)
+
 /* A block device. */
 struct block
   {
@@ -17,8 +26,23 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct block_stats stats;           /* I/O statistics. */
+
+    /* Request queue.  Bios complete in interrupt context, so
+       these members are only accessed with interrupts off. */
+    struct list queue;                  /* Pending bios, sorted by sector. */
+    struct list fifo;                   /* Pending bios, in arrival order. */
+    bool busy;                          /* Is a transfer in progress? */
+    block_sector_t head;                /* Sector after the last transfer. */
+    uint8_t *bounce;                    /* Buffer for merged transfers. */
+
+    /* Transfer in progress, while busy. */
+    struct list batch;                  /* Bios being transferred. */
+    block_sector_t batch_sector;        /* First sector. */
+    size_t batch_cnt;                   /* Number of sectors. */
+    bool batch_write;                   /* Writing? */
+    void *batch_buffer;                 /* Bounce buffer or bio's buffer. */
+    uint64_t batch_tsc;                 /* Time stamp counter at start. */
   };
 
 /* List of all block devices. */
@@ -29,6 +53,20 @@ static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
 
+/* Time stamp counter and timer tick count when the first block
+   device was registered, for converting cycles to real time. */
+static uint64_t base_tsc;
+static int64_t base_ticks;
+
+/* Returns the processor's time stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Returns a human-readable name for the given block device
    TYPE. */
 const char *
@@ -120,9 +158,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, buffer, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,12 +169,381 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, buffer, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it move the whole run with as few
+   commands as they can; others are called once per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, size_t cnt)
+{
+  struct bio bio;
+
+  if (cnt == 0)
+    return;
+  bio_init (&bio, sector, buffer, cnt, false);
+  block_submit (block, &bio);
+  block_wait (block, &bio);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, size_t cnt)
+{
+  struct bio bio;
+
+  if (cnt == 0)
+    return;
+  bio_init (&bio, sector, (void *) buffer, cnt, true);
+  block_submit (block, &bio);
+  block_wait (block, &bio);
+}
+
+/* Request queue. */
+
+/* Initializes BIO to transfer CNT sectors starting at SECTOR
+   between the device and BUFFER.  BIO writes to the device if
+   WRITE is true, otherwise it reads.  BIO has no completion
+   function; the caller may set one in BIO's COMPLETE and AUX
+   members before submitting it. */
+void
+bio_init (struct bio *bio, block_sector_t sector, void *buffer, size_t cnt,
+          bool write)
+{
+  ASSERT (cnt > 0);
+
+  bio->sector = sector;
+  bio->cnt = cnt;
+  bio->buffer = buffer;
+  bio->write = write;
+  bio->complete = NULL;
+  bio->aux = NULL;
+  sema_init (&bio->wait, 0);
+}
+
+/* Returns true if bio A sorts before bio B by starting sector. */
+static bool
+bio_less (const struct list_elem *a_, const struct list_elem *b_,
+          void *aux UNUSED)
+{
+  const struct bio *a = list_entry (a_, struct bio, elem);
+  const struct bio *b = list_entry (b_, struct bio, elem);
+  return a->sector < b->sector;
+}
+
+/* Returns true if bios A and B touch any of the same sectors. */
+static bool
+bio_overlaps (const struct bio *a, const struct bio *b)
+{
+  return a->sector < b->sector + b->cnt && b->sector < a->sector + a->cnt;
+}
+
+static void block_dispatch (struct block *);
+
+/* Queues BIO on BLOCK and, if BLOCK is idle, starts transferring
+   it.  Returns without waiting for the transfer to finish, unless
+   BLOCK's driver can only transfer synchronously.  May be called
+   from an interrupt handler only if BLOCK's driver is
+   asynchronous.  The caller must not touch BIO or its buffer
+   until BIO completes. */
+void
+block_submit (struct block *block, struct bio *bio)
+{
+  enum intr_level old_level;
+
+  check_sector (block, bio->sector);
+  check_sector (block, bio->sector + bio->cnt - 1);
+  ASSERT (!bio->write || block->type != BLOCK_FOREIGN);
+
+  /* The merge buffer can only be allocated with interrupts on.
+     Until then, bios are not merged. */
+  if (block->bounce == NULL && intr_get_level () == INTR_ON)
+    block->bounce = malloc (BLOCK_MERGE_MAX * BLOCK_SECTOR_SIZE);
+
+  old_level = intr_disable ();
+  bio->submit_time = timer_ticks ();
+  bio->submit_tsc = rdtsc ();
+  block->stats.submit_cnt++;
+  block->stats.depth_sum += ++block->stats.depth;
+  if (block->stats.depth > block->stats.max_depth)
+    block->stats.max_depth = block->stats.depth;
+  list_insert_ordered (&block->queue, &bio->elem, bio_less, NULL);
+  list_push_back (&block->fifo, &bio->fifo_elem);
+  if (!block->busy)
+    block_dispatch (block);
+  intr_set_level (old_level);
+}
+
+/* Waits for BIO, previously passed to block_submit() for BLOCK,
+   to complete.  BIO must not have a completion function. */
+void
+block_wait (struct block *block UNUSED, struct bio *bio)
+{
+  ASSERT (bio->complete == NULL);
+  sema_down (&bio->wait);
 }
 
+/* Returns the oldest bio queued on BLOCK ahead of BIO that
+   overlaps it, or a null pointer if there is none.  Such a bio
+   must be transferred before BIO so that, for example, a read
+   sees the data of an earlier write. */
+static struct bio *
+older_conflict (struct block *block, struct bio *bio)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->fifo); e != &bio->fifo_elem;
+       e = list_next (e))
+    {
+      struct bio *older = list_entry (e, struct bio, fifo_elem);
+      if (bio_overlaps (older, bio))
+        return older;
+    }
+  return NULL;
+}
+
+/* Picks the next bio to transfer from BLOCK's nonempty queue:
+   the oldest one if it has passed its deadline, otherwise the
+   first at or after the head position, wrapping around to the
+   lowest sector (C-LOOK). */
+static struct bio *
+elevator_next (struct block *block)
+{
+  struct bio *bio, *older;
+  struct list_elem *e;
+
+  ASSERT (!list_empty (&block->queue));
+
+  bio = list_entry (list_front (&block->fifo), struct bio, fifo_elem);
+  if (timer_elapsed (bio->submit_time) < BLOCK_DEADLINE_TICKS)
+    {
+      bio = list_entry (list_front (&block->queue), struct bio, elem);
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        {
+          struct bio *b = list_entry (e, struct bio, elem);
+          if (b->sector >= block->head)
+            {
+              bio = b;
+              break;
+            }
+        }
+    }
+
+  while ((older = older_conflict (block, bio)) != NULL)
+    bio = older;
+  return bio;
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER by calling BLOCK's synchronous driver functions. */
+static void
+block_transfer (struct block *block, block_sector_t sector, void *buffer_,
+                size_t cnt, bool write)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  if (write)
+    {
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, buffer, cnt);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, buffer, cnt);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Returns the latency histogram bucket for CYCLES. */
+static int
+hist_bucket (uint64_t cycles)
+{
+  int bucket = 0;
+  while (cycles > 1 && bucket < BLOCK_HIST_BUCKETS - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
+
+/* Removes the next bio from BLOCK's queue, along with any queued
+   bios for the sectors just after it in the same direction, and
+   makes them BLOCK's batch.  Merged writes are gathered into the
+   bounce buffer. */
+static void
+block_start_batch (struct block *block)
+{
+  struct bio *first = elevator_next (block);
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!block->busy);
+
+  list_remove (&first->fifo_elem);
+  e = list_remove (&first->elem);
+  list_push_back (&block->batch, &first->elem);
+  block->batch_sector = first->sector;
+  block->batch_cnt = first->cnt;
+  block->batch_write = first->write;
+  block->batch_buffer = first->buffer;
+
+  while (block->bounce != NULL && e != list_end (&block->queue))
+    {
+      struct bio *next = list_entry (e, struct bio, elem);
+      if (next->sector != block->batch_sector + block->batch_cnt
+          || next->write != first->write
+          || block->batch_cnt + next->cnt > BLOCK_MERGE_MAX
+          || older_conflict (block, next) != NULL)
+        break;
+
+      list_remove (&next->fifo_elem);
+      e = list_remove (&next->elem);
+      list_push_back (&block->batch, &next->elem);
+      block->batch_cnt += next->cnt;
+      block->batch_buffer = block->bounce;
+      block->stats.merge_cnt++;
+    }
+
+  /* Account for the time each bio spent queued, and for whether
+     the device has to seek. */
+  block->batch_tsc = rdtsc ();
+  for (e = list_begin (&block->batch); e != list_end (&block->batch);
+       e = list_next (e))
+    {
+      struct bio *b = list_entry (e, struct bio, elem);
+      uint64_t wait = block->batch_tsc - b->submit_tsc;
+      block->stats.wait_cycles += wait;
+      block->stats.wait_hist[hist_bucket (wait)]++;
+    }
+  if (block->batch_sector == block->head)
+    block->stats.seq_cnt++;
+  else
+    block->stats.random_cnt++;
+
+  if (block->batch_write && block->batch_buffer == block->bounce)
+    {
+      uint8_t *p = block->bounce;
+      for (e = list_begin (&block->batch); e != list_end (&block->batch);
+           e = list_next (e))
+        {
+          struct bio *b = list_entry (e, struct bio, elem);
+          memcpy (p, b->buffer, b->cnt * BLOCK_SECTOR_SIZE);
+          p += b->cnt * BLOCK_SECTOR_SIZE;
+        }
+    }
+  block->busy = true;
+}
+
+/* Finishes BLOCK's batch: scatters merged reads out of the bounce
+   buffer and completes each bio in the batch. */
+static void
+block_finish_batch (struct block *block)
+{
+  uint64_t service;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (block->busy);
+
+  if (!block->batch_write && block->batch_buffer == block->bounce)
+    {
+      uint8_t *p = block->bounce;
+      struct list_elem *e;
+      for (e = list_begin (&block->batch); e != list_end (&block->batch);
+           e = list_next (e))
+        {
+          struct bio *b = list_entry (e, struct bio, elem);
+          memcpy (b->buffer, p, b->cnt * BLOCK_SECTOR_SIZE);
+          p += b->cnt * BLOCK_SECTOR_SIZE;
+        }
+    }
+
+  service = rdtsc () - block->batch_tsc;
+  block->stats.service_cycles += service;
+  block->stats.service_hist[hist_bucket (service)]++;
+  if (block->batch_write)
+    block->stats.write_cnt += block->batch_cnt;
+  else
+    block->stats.read_cnt += block->batch_cnt;
+  block->head = block->batch_sector + block->batch_cnt;
+  block->busy = false;
+
+  /* A completion function may reuse or free its bio, so take
+     each bio off the batch before completing it. */
+  while (!list_empty (&block->batch))
+    {
+      struct bio *b = list_entry (list_pop_front (&block->batch),
+                                  struct bio, elem);
+      block->stats.depth--;
+      if (b->complete != NULL)
+        b->complete (b);
+      else
+        sema_up (&b->wait);
+    }
+}
+
+/* Starts transfers from BLOCK's queue while BLOCK is idle.  An
+   asynchronous driver is handed one batch and finishes it later
+   through block_complete().  A synchronous driver is called with
+   interrupts on, so this keeps going until the queue drains. */
+static void
+block_dispatch (struct block *block)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!block->busy && !list_empty (&block->queue))
+    {
+      block_start_batch (block);
+      if (block->ops->start != NULL)
+        block->ops->start (block->aux, block->batch_sector,
+                           block->batch_buffer, block->batch_cnt,
+                           block->batch_write);
+      else
+        {
+          ASSERT (!intr_context ());
+          intr_enable ();
+          block_transfer (block, block->batch_sector, block->batch_buffer,
+                          block->batch_cnt, block->batch_write);
+          intr_disable ();
+          block_finish_batch (block);
+        }
+    }
+}
+
+/* Called by an asynchronous driver, with interrupts off and
+   usually from its interrupt handler, when the transfer most
+   recently started on BLOCK is done.  Completes its bios and
+   starts the next transfer, if any. */
+void
+block_complete (struct block *block)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  block_finish_batch (block);
+  block_dispatch (block);
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -160,10 +565,55 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Copies BLOCK's I/O statistics into STATS.  May be called at
+   any time to sample the statistics of a device in use. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+}
+
+/* Returns the number of time stamp counter cycles per timer tick,
+   measured since the first block device was registered, or 0 if
+   not enough time has passed to tell. */
+uint64_t
+block_cycles_per_tick (void)
+{
+  int64_t ticks = timer_elapsed (base_ticks);
+  return ticks > 0 ? (rdtsc () - base_tsc) / ticks : 0;
+}
+
+/* Prints the nonempty buckets of latency histogram HIST, labeled
+   NAME, in microseconds if CYCLES_PER_TICK is known and in cycles
+   otherwise. */
+static void
+print_hist (const char *name, const unsigned long long hist[],
+            uint64_t cycles_per_tick)
+{
+  int i;
+
+  printf ("  %s latency:", name);
+  for (i = 0; i < BLOCK_HIST_BUCKETS; i++)
+    if (hist[i] != 0)
+      {
+        uint64_t limit = (uint64_t) 1 << (i + 1);
+        if (cycles_per_tick != 0)
+          printf (" <%lluus:%llu",
+                  limit * 1000000 / (cycles_per_tick * TIMER_FREQ) + 1,
+                  hist[i]);
+        else
+          printf (" <%llucy:%llu", limit, hist[i]);
+      }
+  printf ("\n");
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
 {
+  uint64_t cycles_per_tick = block_cycles_per_tick ();
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -171,9 +621,27 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          struct block_stats st;
+          unsigned long long transfers;
+
+          block_get_stats (block, &st);
+          printf ("%s (%s): %llu reads, %llu writes, %llu merged\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  st.read_cnt, st.write_cnt, st.merge_cnt);
+
+          transfers = st.seq_cnt + st.random_cnt;
+          if (transfers == 0)
+            continue;
+          printf ("  %llu bytes read, %llu bytes written, "
+                  "%llu sequential, %llu random transfers\n",
+                  st.read_cnt * BLOCK_SECTOR_SIZE,
+                  st.write_cnt * BLOCK_SECTOR_SIZE,
+                  st.seq_cnt, st.random_cnt);
+          printf ("  queue depth: max %u, mean %llu.%02llu\n",
+                  st.max_depth, st.depth_sum / st.submit_cnt,
+                  st.depth_sum * 100 / st.submit_cnt % 100);
+          print_hist ("queue", st.wait_hist, cycles_per_tick);
+          print_hist ("device", st.service_hist, cycles_per_tick);
         }
     }
 }
@@ -192,14 +660,25 @@ block_register (const char *name, enum block_type type,
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
 
+  if (list_empty (&all_blocks))
+    {
+      base_tsc = rdtsc ();
+      base_ticks = timer_ticks ();
+    }
+
   list_push_back (&all_blocks, &block->list_elem);
   strlcpy (block->name, name, sizeof block->name);
   block->type = type;
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  list_init (&block->queue);
+  list_init (&block->fifo);
+  block->busy = false;
+  block->head = 0;
+  block->bounce = NULL;
+  list_init (&block->batch);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
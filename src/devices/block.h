@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,10 +56,80 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *, size_t);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           size_t);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous I/O.
+
+   A bio describes a transfer of a run of consecutive sectors.
+   block_submit() queues it on the device and returns at once.
+   Pending bios are served in C-LOOK order, with a deadline so
+   that none waits forever, and bios for adjacent sectors are
+   merged into a single transfer.
+
+   When a bio completes, its COMPLETE function is called if it
+   has one.  This may happen in the device's interrupt handler,
+   so the function must not sleep; from then on the bio belongs
+   to the caller again.  A bio without a COMPLETE function must
+   instead be passed to block_wait(). */
+struct bio;
+typedef void bio_complete_func (struct bio *);
+
+struct bio
+  {
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* True to write, false to read. */
+    bio_complete_func *complete; /* Called on completion, or null. */
+    void *aux;                  /* For use by COMPLETE. */
+
+    /* Owned by the block layer. */
+    struct semaphore wait;      /* Up'd on completion if no COMPLETE. */
+    int64_t submit_time;        /* timer_ticks() at submission. */
+    uint64_t submit_tsc;        /* Time stamp counter at submission. */
+    struct list_elem elem;      /* Queue element, sorted by sector. */
+    struct list_elem fifo_elem; /* Queue element, in arrival order. */
+  };
+
+void bio_init (struct bio *, block_sector_t, void *buffer, size_t cnt,
+               bool write);
+void block_submit (struct block *, struct bio *);
+void block_wait (struct block *, struct bio *);
+
 /* Statistics. */
+
+/* Number of buckets in a latency histogram.  Bucket I counts
+   latencies of 2**I to 2**(I+1) - 1 time stamp counter cycles. */
+#define BLOCK_HIST_BUCKETS 40
+
+/* I/O statistics for one block device. */
+struct block_stats
+  {
+    unsigned long long read_cnt;        /* Sectors read. */
+    unsigned long long write_cnt;       /* Sectors written. */
+    unsigned long long merge_cnt;       /* Bios merged into another. */
+    unsigned long long seq_cnt;         /* Transfers continuing the last. */
+    unsigned long long random_cnt;      /* Transfers that seeked. */
+
+    unsigned long long submit_cnt;      /* Bios submitted. */
+    unsigned long long depth_sum;       /* Sum of queue depths at submit. */
+    unsigned int depth;                 /* Bios submitted but not done. */
+    unsigned int max_depth;             /* Largest DEPTH seen. */
+
+    /* Latency in time stamp counter cycles, split into time
+       spent queued and time spent in the driver. */
+    uint64_t wait_cycles;               /* Total queued time. */
+    uint64_t service_cycles;            /* Total driver time. */
+    unsigned long long wait_hist[BLOCK_HIST_BUCKETS];
+    unsigned long long service_hist[BLOCK_HIST_BUCKETS];
+  };
+
+void block_get_stats (struct block *, struct block_stats *);
+uint64_t block_cycles_per_tick (void);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
@@ -65,10 +138,27 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer a run of consecutive sectors at once.
+       If null, the block layer falls back to one call to read or
+       write per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           size_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            size_t cnt);
+
+    /* Optional.  Starts transferring CNT sectors between the
+       device and BUFFER, reading if WRITE is false, and returns
+       without waiting.  Called with interrupts off.  The driver
+       calls block_complete() when the transfer is done.  Drivers
+       that provide this need not provide the functions above. */
+    void (*start) (void *aux, block_sector_t, void *buffer, size_t cnt,
+                   bool write);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_complete (struct block *);
 
 #endif /* devices/block.h */
@@ -8,10 +8,17 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  If a PCI
+   bus-master IDE controller (such as the PIIX emulated by QEMU
+   and Bochs) is present, data is transferred by DMA; otherwise,
+   or if DMA fails, it falls back to PIO.  Transfers are
+   asynchronous: ide_start() issues a command and the interrupt
+   handler carries it through to completion. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +41,21 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus-master IDE port addresses, relative to the channel's
+   bus-master base. */
+#define reg_bm_cmd(CHANNEL) ((CHANNEL)->bm_base + 0)    /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2) /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)   /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/stop bus master. */
+#define BM_CMD_READ 0x08        /* 1=device to memory, 0=memory to device. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_ERR 0x02         /* DMA error (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +71,33 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors that a single READ/WRITE command can transfer.
+   A sector count of 0 in the Sector Count register means 256. */
+#define IDE_MAX_SECTORS 256
+
+/* Most sectors per DRQ block that we request for READ/WRITE
+   MULTIPLE, even if the disk supports more. */
+#define IDE_MULTIPLE_MAX 16
+
+/* Physical Region Descriptor, one entry in a bus-master PRD
+   table.  Describes a physically contiguous buffer that must not
+   cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of buffer. */
+    uint16_t size;              /* Byte count, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_BOUNDARY 0x10000    /* PRD regions may not cross this. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +106,17 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple_cnt;           /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    struct block *block;        /* Block device, once registered. */
+
+    /* Transfer in progress or waiting for the channel. */
+    block_sector_t xfer_sector; /* Next sector to transfer. */
+    uint8_t *xfer_buffer;       /* Buffer for next sector. */
+    size_t xfer_cnt;            /* Sectors left in transfer. */
+    bool xfer_write;            /* Writing? */
+    size_t cmd_cnt;             /* Sectors left in current command. */
+    bool cmd_dma;               /* Is current command using DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -67,11 +127,16 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus-master base I/O port, 0 if no DMA. */
+    struct prd *prdt;           /* PRD table, one page from palloc. */
+
+    struct ata_disk *active;    /* Disk with a transfer in progress. */
+    struct ata_disk *waiting;   /* Disk waiting to start a transfer. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -81,26 +146,35 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static bool set_multiple_mode (struct ata_disk *, int cnt);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool spin_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static bool dma_start (struct ata_disk *, block_sector_t, void *buffer,
+                       size_t cnt, bool write);
+static bool dma_finish (struct ata_disk *);
+
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,9 +197,19 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
+      c->active = c->waiting = NULL;
       sema_init (&c->completion_wait, 0);
+
+      /* Set up bus-master DMA, if available. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +220,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple_cnt = 0;
+          d->block = NULL;
         }
 
       /* Register interrupt handler. */
@@ -155,6 +241,72 @@ ide_init (void)
     }
 }
 
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit PCI configuration register REG of function
+   FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit PCI configuration register REG of
+   function FUNC of device DEV on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Searches PCI bus 0 for a bus-master capable IDE controller
+   whose channels are at the legacy addresses, enables bus
+   mastering on it, and returns its bus-master base I/O port.
+   Returns 0 if there is no such controller, in which case all
+   transfers use PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar, cmd;
+        uint8_t prog_if;
+
+        if ((pci_read_config (dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 1 (mass storage), subclass 1 (IDE), with the
+           bus-master bit set and both channels in compatibility
+           mode. */
+        class = pci_read_config (dev, func, 0x08);
+        prog_if = class >> 8;
+        if ((class >> 16) != 0x0101
+            || (prog_if & 0x80) == 0 || (prog_if & 0x05) != 0)
+          continue;
+
+        /* BAR 4 holds the bus-master I/O base. */
+        bar = pci_read_config (dev, func, 0x20);
+        if ((bar & 1) == 0 || (bar & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering.  Writing zeros to
+           the status half leaves its write-1-to-clear bits
+           alone. */
+        cmd = pci_read_config (dev, func, 0x04) & 0xffff;
+        pci_write_config (dev, func, 0x04, cmd | 0x05);
+        return bar & 0xfffc;
+      }
+
+  return 0;
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -262,6 +414,7 @@ identify_ata_device (struct ata_disk *d)
   struct channel *c = d->channel;
   char id[BLOCK_SECTOR_SIZE];
   block_sector_t capacity;
+  int max_multiple;
   char *model, *serial;
   char extra_info[128];
   struct block *block;
@@ -284,6 +437,7 @@ identify_ata_device (struct ata_disk *d)
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  max_multiple = (uint8_t) id[47 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
@@ -303,12 +457,40 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Enable READ/WRITE MULTIPLE if the disk supports it, so that
+     multi-sector transfers take one interrupt per block of
+     sectors instead of one per sector. */
+  if (max_multiple > 0)
+    {
+      int cnt = max_multiple < IDE_MULTIPLE_MAX ? max_multiple
+                                                : IDE_MULTIPLE_MAX;
+      if (set_multiple_mode (d, cnt))
+        d->multiple_cnt = cnt;
+    }
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  d->block = block;
   partition_scan (block);
 }
 
+/* Sends a SET MULTIPLE MODE command to disk D asking for CNT
+   sectors per DRQ block.  Returns true if successful, false if
+   the disk rejected the request. */
+static bool
+set_multiple_mode (struct ata_disk *d, int cnt)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  return (inb (reg_status (c)) & STA_ERR) == 0;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +519,192 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Returns the number of sectors that disk D transfers per
+   interrupt for multi-sector commands. */
+static size_t
+sectors_per_interrupt (const struct ata_disk *d)
+{
+  return d->multiple_cnt > 0 ? d->multiple_cnt : 1;
+}
+
+/* Moves disk D's transfer in progress forward by CNT sectors. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+xfer_advance (struct ata_disk *d, size_t cnt)
+{
+  d->xfer_sector += cnt;
+  d->xfer_buffer += cnt * BLOCK_SECTOR_SIZE;
+  d->xfer_cnt -= cnt;
+  d->cmd_cnt -= cnt;
+}
+
+/* Reads the next block of sectors of disk D's PIO read from the
+   data register. */
+static void
+pio_input_block (struct ata_disk *d)
+{
+  size_t chunk = sectors_per_interrupt (d);
+  if (chunk > d->cmd_cnt)
+    chunk = d->cmd_cnt;
+
+  if (!spin_while_busy (d))
+    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, d->xfer_sector);
+  for (; chunk > 0; chunk--)
+    {
+      input_sector (d->channel, d->xfer_buffer);
+      xfer_advance (d, 1);
+    }
+}
+
+/* Writes the next block of sectors of disk D's PIO write to the
+   data register. */
+static void
+pio_output_block (struct ata_disk *d)
+{
+  size_t chunk = sectors_per_interrupt (d);
+  if (chunk > d->cmd_cnt)
+    chunk = d->cmd_cnt;
+
+  if (!spin_while_busy (d))
+    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, d->xfer_sector);
+  for (; chunk > 0; chunk--)
+    {
+      output_sector (d->channel, d->xfer_buffer);
+      xfer_advance (d, 1);
+    }
+}
+
+/* Issues a command for the next part of disk D's transfer, up to
+   IDE_MAX_SECTORS sectors, by DMA if possible and otherwise by
+   PIO.  READ/WRITE MULTIPLE take one interrupt per block of
+   sectors rather than per sector, so we use them if the disk
+   supports them.  D must be its channel's active disk. */
+static void
+start_command (struct ata_disk *d)
 {
-  struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+
+  ASSERT (c->active == d);
+
+  d->cmd_cnt = d->xfer_cnt < IDE_MAX_SECTORS ? d->xfer_cnt : IDE_MAX_SECTORS;
+  d->cmd_dma = dma_start (d, d->xfer_sector, d->xfer_buffer, d->cmd_cnt,
+                          d->xfer_write);
+  if (d->cmd_dma)
+    return;
+
+  select_sectors (d, d->xfer_sector, d->cmd_cnt);
+  if (d->xfer_write)
+    {
+      issue_command (c, (d->multiple_cnt > 0
+                         ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY));
+      pio_output_block (d);
+    }
+  else
+    issue_command (c, (d->multiple_cnt > 0
+                       ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY));
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Starts transferring CNT sectors starting at SEC_NO between disk
+   D and BUFFER, reading if WRITE is false, and returns without
+   waiting.  The interrupt handler carries the transfer through
+   and calls block_complete() at the end.  If the other disk on
+   D's channel is busy, D's transfer starts when that one is
+   done. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_start (void *d_, block_sector_t sec_no, void *buffer, size_t cnt,
+           bool write)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->active != d && c->waiting != d);
+
+  d->xfer_sector = sec_no;
+  d->xfer_buffer = buffer;
+  d->xfer_cnt = cnt;
+  d->xfer_write = write;
+  if (c->active == NULL)
+    {
+      c->active = d;
+      start_command (d);
+    }
+  else
+    {
+      ASSERT (c->waiting == NULL);
+      c->waiting = d;
+    }
+}
+
+/* Advances the transfer on disk D, its channel's active disk,
+   after an interrupt from the channel. */
+static void
+transfer_interrupt (struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+
+  if (d->cmd_dma)
+    {
+      if (!dma_finish (d))
+        {
+          /* Retry by PIO. */
+          start_command (d);
+          return;
+        }
+      xfer_advance (d, d->cmd_cnt);
+    }
+  else if (!d->xfer_write)
+    {
+      pio_input_block (d);
+      if (d->cmd_cnt > 0)
+        return;
+    }
+  else if (d->cmd_cnt > 0)
+    {
+      /* The disk took the previous block; send the next one.  The
+         interrupt after the last block completes the command. */
+      pio_output_block (d);
+      return;
+    }
+
+  if (d->xfer_cnt > 0)
+    {
+      start_command (d);
+      return;
+    }
+
+  /* D's transfer is done.  Hand the channel to the other disk
+     first, since completing D's transfer may start a new one
+     on D. */
+  c->active = c->waiting;
+  c->waiting = NULL;
+  if (c->active != NULL)
+    start_command (c->active);
+  block_complete (d->block);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ide_start
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
+   writes SEC_NO and CNT to the disk's sector selection
+   registers.  CNT must be between 1 and IDE_MAX_SECTORS.  (We
    use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= IDE_MAX_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == IDE_MAX_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -401,17 +712,118 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
         DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
 }
 
+/* Fills in channel C's PRD table to describe the CNT bytes at
+   kernel virtual address BUFFER.  Returns false if BUFFER cannot
+   be described, because it is not a word-aligned kernel address
+   or needs more entries than the table holds. */
+static bool
+build_prd_table (struct channel *c, void *buffer, size_t cnt)
+{
+  uintptr_t phys;
+  size_t i;
+
+  if (!is_kernel_vaddr (buffer) || ((uintptr_t) buffer & 1) != 0)
+    return false;
+
+  /* Kernel virtual memory maps physical memory linearly, so the
+     buffer is physically contiguous; split it only at 64 kB
+     boundaries. */
+  phys = vtop (buffer);
+  for (i = 0; cnt > 0; i++)
+    {
+      size_t size = PRD_BOUNDARY - phys % PRD_BOUNDARY;
+      if (size > cnt)
+        size = cnt;
+      if (i >= PRD_CNT)
+        return false;
+
+      c->prdt[i].addr = phys;
+      c->prdt[i].size = size & 0xffff;
+      c->prdt[i].flags = 0;
+      phys += size;
+      cnt -= size;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Starts transferring CNT consecutive sectors starting at SEC_NO
+   between disk D and BUFFER by bus-master DMA, reading from the
+   disk if WRITE is false and writing to it otherwise.  The
+   channel raises an interrupt when the transfer is done, after
+   which dma_finish() must be called.  Returns false if DMA is
+   not available for this transfer, in which case the caller
+   should use PIO instead. */
+static bool
+dma_start (struct ata_disk *d, block_sector_t sec_no, void *buffer,
+           size_t cnt, bool write)
+{
+  struct channel *c = d->channel;
+
+  ASSERT (cnt >= 1 && cnt <= IDE_MAX_SECTORS);
+
+  if (c->bm_base == 0
+      || !build_prd_table (c, buffer, cnt * BLOCK_SECTOR_SIZE))
+    return false;
+
+  /* Program the bus master: PRD table, direction, and clear any
+     stale interrupt and error status. */
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_cmd (c), write ? 0 : BM_CMD_READ);
+  outb (reg_bm_status (c),
+        inb (reg_bm_status (c)) | BM_STA_INTR | BM_STA_ERR);
+
+  /* Issue the command and start the bus master. */
+  select_sectors (d, sec_no, cnt);
+  issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_cmd (c), (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  return true;
+}
+
+/* Stops the bus master after the DMA transfer started on disk D
+   by dma_start() has raised its interrupt.  Returns true if the
+   transfer succeeded.  If the controller reports an error,
+   disables DMA on the channel from then on and returns false. */
+static bool
+dma_finish (struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  uint8_t bm_status;
+
+  outb (reg_bm_cmd (c), inb (reg_bm_cmd (c)) & ~BM_CMD_START);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_INTR | BM_STA_ERR);
+  if ((bm_status & BM_STA_ERR) != 0
+      || (inb (reg_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA failed, sector=%"PRDSNu", falling back to PIO\n",
+              d->name, d->xfer_sector);
+      c->bm_base = 0;
+      return false;
+    }
+  return true;
+}
+
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
+issue_command (struct channel *c, uint8_t command) 
+{
+  c->expecting_interrupt = true;
+  outb (reg_command (c), command);
+}
+
+/* Writes COMMAND to channel C, as issue_command(), for a caller
+   that will wait for the completion interrupt on C's
+   completion_wait semaphore. */
+static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
   ASSERT (intr_get_level () == INTR_ON);
 
-  c->expecting_interrupt = true;
-  outb (reg_command (c), command);
+  issue_command (c, command);
 }
 
 /* Reads a sector from channel C's data register in PIO mode into
@@ -446,7 +858,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,6 +891,25 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Like wait_while_busy(), but spins instead of sleeping, so that
+   it may be used with interrupts off, and gives up after about
+   10 ms.  By the time a disk interrupts, BSY should already be
+   clear. */
+static bool
+spin_while_busy (const struct ata_disk *d) 
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      if (!(inb (reg_alt_status (c)) & STA_BSY))
+        return (inb (reg_alt_status (c)) & STA_DRQ) != 0;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +920,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,7 +942,12 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt) 
+        if (c->active != NULL)
+          {
+            inb (reg_status (c));               /* Acknowledge interrupt. */
+            transfer_interrupt (c->active);
+          }
+        else if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
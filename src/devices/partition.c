@@ -11,6 +11,8 @@ struct partition
   {
     struct block *block;                /* Underlying block device. */
     block_sector_t start;               /* First sector within device. */
+    struct block *self;                 /* This partition's block device. */
+    struct bio bio;                     /* Transfer on the underlying device. */
   };
 
 static struct block_operations partition_operations;
@@ -181,7 +183,8 @@ found_partition (struct block *block, uint8_t part_type,
       snprintf (name, sizeof name, "%s%d", block_name (block), part_nr);
       snprintf (extra_info, sizeof extra_info, "%s (%02x)",
                 partition_type_name (part_type), part_type);
-      block_register (name, type, extra_info, size, &partition_operations, p);
+      p->self = block_register (name, type, extra_info, size,
+                                &partition_operations, p);
     }
 }
 
@@ -298,27 +301,35 @@ partition_type_name (uint8_t type)
   return type_names[type] != NULL ? type_names[type] : "Unknown";
 }
 
-/* Reads sector SECTOR from partition P into BUFFER, which must
-   have room for BLOCK_SECTOR_SIZE bytes. */
+/* Completes a transfer on a partition once the corresponding
+   transfer on the underlying device is done. */
 static void
-partition_read (void *p_, block_sector_t sector, void *buffer)
+partition_complete (struct bio *bio)
 {
-  struct partition *p = p_;
-  block_read (p->block, p->start + sector, buffer);
+  struct partition *p = bio->aux;
+  block_complete (p->self);
 }
 
-/* Write sector SECTOR to partition P from BUFFER, which must
-   contain BLOCK_SECTOR_SIZE bytes.  Returns after the block has
-   acknowledged receiving the data. */
+/* Starts transferring CNT sectors starting at SECTOR between
+   partition P and BUFFER, by submitting the corresponding range
+   of the underlying device.  The block layer has at most one
+   transfer in progress per device, so P's single bio suffices. */
 static void
-partition_write (void *p_, block_sector_t sector, const void *buffer)
+partition_start (void *p_, block_sector_t sector, void *buffer, size_t cnt,
+                 bool write)
 {
   struct partition *p = p_;
-  block_write (p->block, p->start + sector, buffer);
+  bio_init (&p->bio, p->start + sector, buffer, cnt, write);
+  p->bio.complete = partition_complete;
+  p->bio.aux = p;
+  block_submit (p->block, &p->bio);
 }
 
 static struct block_operations partition_operations =
   {
-    partition_read,
-    partition_write
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    partition_start
   };
@@ -0,0 +1,180 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A RAM disk is a block device whose sectors live in pages from
+   palloc.  It has no seek or transfer latency, so it is useful
+   for separating the CPU cost of the file system from the cost
+   of the device, and as fast, volatile backing storage.
+
+   A RAM disk is either created empty, or loaded with a copy of
+   another block device.  Reads from a copy never touch the
+   original device, but writes go through to it, so that writes
+   (such as fsutil_extract() erasing its archive) are not lost. */
+
+/* Number of sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    char name[16];              /* Name, e.g. "ram0". */
+    uint8_t **pages;            /* Pages holding the sectors. */
+    size_t page_cnt;            /* Number of pages. */
+    struct block *backing;      /* Device this is a copy of, or null. */
+  };
+
+static struct block_operations ramdisk_operations;
+
+/* Allocates a RAM disk with room for SIZE sectors, all zero.
+   Returns a null pointer if memory is not available. */
+static struct ramdisk *
+ramdisk_alloc (const char *name, block_sector_t size)
+{
+  struct ramdisk *rd;
+  size_t i;
+
+  rd = malloc (sizeof *rd);
+  if (rd == NULL)
+    return NULL;
+  strlcpy (rd->name, name, sizeof rd->name);
+  rd->page_cnt = DIV_ROUND_UP (size, SECTORS_PER_PAGE);
+  rd->backing = NULL;
+  rd->pages = calloc (rd->page_cnt, sizeof *rd->pages);
+  if (rd->pages == NULL)
+    {
+      free (rd);
+      return NULL;
+    }
+
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        {
+          while (i-- > 0)
+            palloc_free_page (rd->pages[i]);
+          free (rd->pages);
+          free (rd);
+          return NULL;
+        }
+    }
+  return rd;
+}
+
+/* Creates and registers an empty, writable RAM disk with the
+   given NAME, TYPE, and SIZE in sectors.  Returns the new block
+   device, or a null pointer if there is not enough memory. */
+struct block *
+ramdisk_create (const char *name, enum block_type type, block_sector_t size)
+{
+  struct ramdisk *rd = ramdisk_alloc (name, size);
+  if (rd == NULL)
+    {
+      printf ("%s: not enough memory for RAM disk\n", name);
+      return NULL;
+    }
+  return block_register (name, type, "RAM disk", size,
+                         &ramdisk_operations, rd);
+}
+
+/* Creates and registers a RAM disk with the given NAME and TYPE
+   holding a copy of all of block device SRC, which also receives
+   all writes to the copy.  Returns
+   the new block device, or a null pointer if there is not enough
+   memory. */
+struct block *
+ramdisk_load (const char *name, enum block_type type, struct block *src)
+{
+  block_sector_t size = block_size (src);
+  struct ramdisk *rd = ramdisk_alloc (name, size);
+  char extra_info[32];
+  size_t i;
+
+  if (rd == NULL)
+    {
+      printf ("%s: not enough memory to load %s\n", name, block_name (src));
+      return NULL;
+    }
+
+  /* Read a page's worth of sectors at a time. */
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      block_sector_t sector = i * SECTORS_PER_PAGE;
+      block_sector_t cnt = size - sector;
+      if (cnt > SECTORS_PER_PAGE)
+        cnt = SECTORS_PER_PAGE;
+      block_read_multiple (src, sector, rd->pages[i], cnt);
+    }
+  rd->backing = src;
+
+  snprintf (extra_info, sizeof extra_info, "RAM copy of %s",
+            block_name (src));
+  return block_register (name, type, extra_info, size,
+                         &ramdisk_operations, rd);
+}
+
+/* Returns the address of sector SECTOR within RAM disk RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  ASSERT (sector / SECTORS_PER_PAGE < rd->page_cnt);
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SECTOR from RAM disk RD_ into
+   BUFFER. */
+static void
+ramdisk_read_multiple (void *rd_, block_sector_t sector, void *buffer_,
+                       size_t cnt)
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *buffer = buffer_;
+
+  for (; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+    memcpy (buffer, sector_addr (rd, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes CNT sectors starting at SECTOR to RAM disk RD_ from
+   BUFFER. */
+static void
+ramdisk_write_multiple (void *rd_, block_sector_t sector,
+                        const void *buffer_, size_t cnt)
+{
+  struct ramdisk *rd = rd_;
+  const uint8_t *buffer = buffer_;
+
+  if (rd->backing != NULL)
+    block_write_multiple (rd->backing, sector, buffer, cnt);
+  for (; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+    memcpy (sector_addr (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SECTOR from RAM disk RD_ into BUFFER. */
+static void
+ramdisk_read (void *rd_, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (rd_, sector, buffer, 1);
+}
+
+/* Writes sector SECTOR to RAM disk RD_ from BUFFER. */
+static void
+ramdisk_write (void *rd_, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (rd_, sector, buffer, 1);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL
+  };
@@ -5,13 +5,17 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "filesys/page-cache.h"
 #endif
 
 /* Keyboard control register port. */
@@ -130,8 +134,12 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  kmem_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  buffer_cache_print_stats ();
+  page_cache_print_stats ();
+  journal_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -1,115 +1,807 @@
 #include "cache.h"
+#include <round.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "filesys/journal.h"
 
-static int capacity;
+/* The cache holds up to CAPACITY sectors.  Entries are backed by
+   buffer pages lazily, one page (ENTRIES_PER_PAGE entries) at a
+   time, as misses need room, for as long as the kernel pool keeps
+   GROW_RESERVE pages free.  When the kernel pool runs dry, the
+   page allocator calls buffer_cache_shrink() to take back pages
+   whose entries are all clean, down to BUFFER_CACHE_MIN
+   entries. */
+#define ENTRIES_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+#define GROW_RESERVE 32
 
-struct buffer_cache_entry buffer_cache_list[BUFFER_CACHE_SIZE];
+struct buffer_cache_entry *buffer_cache_list;
+
+static size_t capacity;                 /* Maximum number of entries */
+static size_t min_cnt;                  /* Never shrink below this */
+static size_t backed_cnt;               /* Entries with a buffer */
+static uint8_t **pages;                 /* Buffer page of each group */
+
+/* Maps sectors to the entries caching them. */
+static struct hash buffer_cache_map;
 
 struct lock buffer_cache_lock;
 
-static int clock_pin;
+/* Replacement follows the "simplified 2Q" scheme.  A data block
+   read for the first time goes on the probation queue, which is
+   FIFO, and stays there however often it is hit.  Only a block
+   that comes back soon after being evicted from probation, as
+   remembered in a small ring of "ghost" sector numbers, goes on
+   the protected queue, which is LRU.  A large sequential read
+   therefore cycles through probation and leaves the protected
+   blocks alone.
+
+   Metadata (inodes, index blocks and directory contents) goes on
+   the protected queue straight away.  The protected queue is kept
+   as two LRU lists, one per class, and eviction takes from the
+   data list until it is empty, so a working set of metadata
+   survives streaming I/O. */
+#define PROBATION_TARGET (backed_cnt / 4)
+
+static struct list free_queue;          /* Unused entries */
+static struct list probation_queue;     /* Oldest first */
+static struct list protected_data;      /* Least recently used first */
+static struct list protected_meta;      /* Least recently used first */
+static size_t probation_cnt;
+
+/* A sector recently evicted from probation.  The ring is
+   overwritten in order; the hash finds a sector in it. */
+struct ghost
+  {
+    block_sector_t block_index;         /* BUFFER_CACHE_NO_OWNER if unused */
+    struct hash_elem hash_elem;         /* In ghost_map, while used */
+  };
+
+static struct ghost *ghosts;            /* Ring of ghosts */
+static size_t ghost_cnt;
+static size_t ghost_next;
+static struct hash ghost_map;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt;
+static long long meta_hit_cnt, meta_miss_cnt;
+static long long ghost_hit_cnt, evict_cnt, writeback_cnt;
+static long long shrink_cnt;
+
+/* Dirty entries, each kept on the bucket its owner hashes to, so
+   that flushing one inode's blocks looks only at dirty entries
+   instead of the whole cache. */
+static struct list dirty_buckets[BUFFER_CACHE_DIRTY_BUCKETS];
+
+/* While the file system is journaled, entries dirtied since the
+   last commit, which must not be written home until they have
+   been logged. */
+static struct list txn_list;
+static size_t txn_cnt;
 
+static void buffer_cache_commit_locked (void);
+
+static struct list *
+dirty_bucket (block_sector_t owner)
+{
+    return &dirty_buckets[owner % BUFFER_CACHE_DIRTY_BUCKETS];
+}
+
+static unsigned
+buffer_cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct buffer_cache_entry *bce = hash_entry (e, struct buffer_cache_entry,
+                                                       hash_elem);
+    return hash_int (bce->block_index);
+}
+
+static bool
+buffer_cache_less (const struct hash_elem *a, const struct hash_elem *b,
+                   void *aux UNUSED)
+{
+    return (hash_entry (a, struct buffer_cache_entry, hash_elem)->block_index
+            < hash_entry (b, struct buffer_cache_entry, hash_elem)->block_index);
+}
+
+static unsigned
+ghost_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int (hash_entry (e, struct ghost, hash_elem)->block_index);
+}
+
+static bool
+ghost_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+    return (hash_entry (a, struct ghost, hash_elem)->block_index
+            < hash_entry (b, struct ghost, hash_elem)->block_index);
+}
+
+/* Gives an unbacked group of entries a buffer page and puts them
+   on the free queue.  Returns false if the cache is at capacity
+   or the kernel pool is running low. */
+static bool
+buffer_cache_grow (bool force)
+{
+    size_t group;
+
+    if (backed_cnt >= capacity
+        || (!force && palloc_free_pages (0) <= GROW_RESERVE))
+      {
+          return false;
+      }
+    for (group = 0; pages[group] != NULL; group++)
+      {
+          continue;
+      }
+
+    pages[group] = palloc_get_page (0);
+    if (pages[group] == NULL)
+      {
+          return false;
+      }
+    for (int i = 0; i < ENTRIES_PER_PAGE; i++)
+      {
+          struct buffer_cache_entry *bce = &buffer_cache_list[group * ENTRIES_PER_PAGE + i];
+          bce->buffer = pages[group] + i * BLOCK_SECTOR_SIZE;
+          bce->queue = BUFFER_CACHE_FREE;
+          list_push_back (&free_queue, &bce->queue_elem);
+      }
+    backed_cnt += ENTRIES_PER_PAGE;
+    return true;
+}
+
+/* Sets up a cache of up to MAX_SECTORS sectors, or if MAX_SECTORS
+   is 0, of up to 1/BUFFER_CACHE_DEFAULT_SHARE of the free kernel
+   pool. */
 void
-buffer_cache_init()
+buffer_cache_init (size_t max_sectors)
 {
     lock_init (&buffer_cache_lock);
     printf("lock inited\n");
-    clock_pin = 0;
 
-    for (int i = 0; i < BUFFER_CACHE_SIZE; i++)
+    /* Blocks of the running transaction cannot be evicted, so the
+       cache must always have room for more than a transaction. */
+    ASSERT (BUFFER_CACHE_MIN >= 2 * JOURNAL_TXN_MAX);
+    if (max_sectors == 0)
+      {
+          max_sectors = (palloc_free_pages (0) / BUFFER_CACHE_DEFAULT_SHARE
+                         * ENTRIES_PER_PAGE);
+      }
+    if (max_sectors < BUFFER_CACHE_MIN)
+      {
+          max_sectors = BUFFER_CACHE_MIN;
+      }
+    capacity = ROUND_UP (max_sectors, ENTRIES_PER_PAGE);
+    min_cnt = BUFFER_CACHE_MIN;
+    backed_cnt = 0;
+    ghost_cnt = capacity / 2;
+    ghost_next = 0;
+
+    buffer_cache_list = calloc (capacity, sizeof *buffer_cache_list);
+    pages = calloc (capacity / ENTRIES_PER_PAGE, sizeof *pages);
+    ghosts = malloc (ghost_cnt * sizeof *ghosts);
+    if (buffer_cache_list == NULL || pages == NULL || ghosts == NULL
+        || !hash_init (&buffer_cache_map, buffer_cache_hash, buffer_cache_less,
+                       NULL)
+        || !hash_init (&ghost_map, ghost_hash, ghost_less, NULL))
+      {
+          PANIC ("buffer cache allocation failed");
+      }
+
+    list_init (&free_queue);
+    list_init (&probation_queue);
+    list_init (&protected_data);
+    list_init (&protected_meta);
+    list_init (&txn_list);
+    probation_cnt = 0;
+    for (size_t i = 0; i < capacity; i++)
       {
           buffer_cache_list[i].inuse = false;
+          buffer_cache_list[i].dirty = false;
+          buffer_cache_list[i].txn = false;
+          buffer_cache_list[i].queue = BUFFER_CACHE_NONE;
+      }
+    for (int i = 0; i < BUFFER_CACHE_DIRTY_BUCKETS; i++)
+      {
+          list_init (&dirty_buckets[i]);
+      }
+    for (size_t i = 0; i < ghost_cnt; i++)
+      {
+          ghosts[i].block_index = BUFFER_CACHE_NO_OWNER;
+      }
+
+    while (backed_cnt < min_cnt)
+      {
+          if (!buffer_cache_grow (true))
+            {
+                PANIC ("buffer cache allocation failed");
+            }
       }
-    capacity = 0;
+    palloc_add_reclaim (buffer_cache_shrink);
+}
+
+/* Takes back the buffer page of a group of entries that are all
+   clean, dropping whatever they cache.  Called by the page
+   allocator when the kernel pool is exhausted.  Returns true if a
+   page was freed. */
+bool
+buffer_cache_shrink (void)
+{
+    bool success = false;
+
+    if (lock_held_by_current_thread (&buffer_cache_lock)
+        || !lock_try_acquire (&buffer_cache_lock))
+      {
+          return false;
+      }
+
+    for (size_t group = capacity / ENTRIES_PER_PAGE;
+         group-- > 0 && backed_cnt > min_cnt; )
+      {
+          struct buffer_cache_entry *first = &buffer_cache_list[group * ENTRIES_PER_PAGE];
+          int i;
+
+          if (pages[group] == NULL)
+            {
+                continue;
+            }
+          for (i = 0; i < ENTRIES_PER_PAGE; i++)
+            {
+                if (first[i].dirty)
+                  {
+                      break;
+                  }
+            }
+          if (i < ENTRIES_PER_PAGE)
+            {
+                continue;
+            }
+
+          for (i = 0; i < ENTRIES_PER_PAGE; i++)
+            {
+                struct buffer_cache_entry *bce = &first[i];
+                if (bce->inuse)
+                  {
+                      hash_delete (&buffer_cache_map, &bce->hash_elem);
+                      bce->inuse = false;
+                  }
+                if (bce->queue == BUFFER_CACHE_PROBATION)
+                  {
+                      probation_cnt--;
+                  }
+                list_remove (&bce->queue_elem);
+                bce->queue = BUFFER_CACHE_NONE;
+                bce->buffer = NULL;
+            }
+          palloc_free_page (pages[group]);
+          pages[group] = NULL;
+          backed_cnt -= ENTRIES_PER_PAGE;
+          shrink_cnt++;
+          success = true;
+          break;
+      }
+
+    lock_release (&buffer_cache_lock);
+    return success;
 }
 
 void
 buffer_cache_close(void)
 {
-    lock_acquire (&buffer_cache_lock);
+    buffer_cache_flush_all ();
+}
 
-    for (int i = 0; i < BUFFER_CACHE_SIZE; i++)
+/* Writes every dirty block in the cache back to disk, except
+   blocks of the running transaction, which may not go home until
+   it commits.  Writes are submitted BUFFER_CACHE_MIN at a time
+   before waiting for any, so that the block layer can sort them
+   and merge runs of adjacent sectors. */
+static void
+buffer_cache_flush_all_locked (void)
+{
+    static struct bio bios[BUFFER_CACHE_MIN];
+    int cnt = 0;
+
+    ASSERT (lock_held_by_current_thread (&buffer_cache_lock));
+
+    for (int i = 0; i < BUFFER_CACHE_DIRTY_BUCKETS; i++)
       {
-          if (buffer_cache_list[i].dirty == true \
-              && buffer_cache_list[i].inuse == true)
+          struct list_elem *e = list_begin (&dirty_buckets[i]);
+          while (e != list_end (&dirty_buckets[i]))
             {
-                buffer_cache_flush (&buffer_cache_list[i]);
+                struct buffer_cache_entry *bce = list_entry (e, struct buffer_cache_entry,
+                                                             dirty_elem);
+                e = list_next (e);
+                if (bce->txn)
+                  {
+                      continue;
+                  }
+                list_remove (&bce->dirty_elem);
+                bio_init (&bios[cnt], bce->block_index, bce->buffer, 1, true);
+                block_submit (fs_device, &bios[cnt++]);
+                bce->dirty = false;
+                if (cnt == BUFFER_CACHE_MIN)
+                  {
+                      for (int j = 0; j < cnt; j++)
+                        {
+                            block_wait (fs_device, &bios[j]);
+                        }
+                      cnt = 0;
+                  }
             }
       }
-    
+    for (int i = 0; i < cnt; i++)
+      {
+          block_wait (fs_device, &bios[i]);
+      }
+}
+
+void
+buffer_cache_flush_all (void)
+{
+    lock_acquire (&buffer_cache_lock);
+    buffer_cache_flush_all_locked ();
     lock_release (&buffer_cache_lock);
 }
 
+/* Logs the running transaction, then, if the log is full, writes
+   every dirty block home so that the log can start over. */
+static void
+buffer_cache_commit_locked (void)
+{
+    static block_sector_t sectors[JOURNAL_TXN_MAX];
+    static void *buffers[JOURNAL_TXN_MAX];
+    size_t cnt = 0;
+
+    ASSERT (lock_held_by_current_thread (&buffer_cache_lock));
+    if (txn_cnt == 0)
+      {
+          return;
+      }
+
+    while (!list_empty (&txn_list))
+      {
+          struct list_elem *e = list_pop_front (&txn_list);
+          struct buffer_cache_entry *bce = list_entry (e, struct buffer_cache_entry,
+                                                       txn_elem);
+          sectors[cnt] = bce->block_index;
+          buffers[cnt++] = bce->buffer;
+          bce->txn = false;
+      }
+    txn_cnt = 0;
+
+    if (journal_log (sectors, buffers, cnt))
+      {
+          buffer_cache_flush_all_locked ();
+          journal_reset ();
+      }
+}
+
+/* Commits the running transaction to the journal.  Called by
+   journal_commit(), which makes sure no operation is half
+   done. */
 void
-buffer_cache_read(struct block *src, block_sector_t block_index, void *buffer)
+buffer_cache_commit (void)
 {
     lock_acquire (&buffer_cache_lock);
+    buffer_cache_commit_locked ();
+    lock_release (&buffer_cache_lock);
+}
+
+/* Commits the running transaction, writes every dirty block home
+   and empties the log.  Called by journal_checkpoint(), which
+   makes sure no operation is half done. */
+void
+buffer_cache_checkpoint (void)
+{
+    lock_acquire (&buffer_cache_lock);
+    buffer_cache_commit_locked ();
+    buffer_cache_flush_all_locked ();
+    journal_reset ();
+    lock_release (&buffer_cache_lock);
+}
+
+/* Returns the number of blocks in the running transaction. */
+size_t
+buffer_cache_txn_size (void)
+{
+    return txn_cnt;
+}
+
+/* Writes back only the dirty blocks belonging to the inode in
+   sector OWNER, except blocks of the running transaction. */
+void
+buffer_cache_flush_owner (block_sector_t owner)
+{
+    lock_acquire (&buffer_cache_lock);
+
+    struct list *bucket = dirty_bucket (owner);
+    struct list_elem *e = list_begin (bucket);
+    while (e != list_end (bucket))
+      {
+          struct buffer_cache_entry *bce = list_entry (e, struct buffer_cache_entry,
+                                                       dirty_elem);
+          e = list_next (e);
+          if (bce->owner == owner && !bce->txn)
+            {
+                buffer_cache_flush (bce);
+            }
+      }
+
+    lock_release (&buffer_cache_lock);
+}
+
+/* Moves BCE onto QUEUE, at the most recently used end. */
+static void
+buffer_cache_enqueue (struct buffer_cache_entry *bce,
+                      enum buffer_cache_queue queue)
+{
+    if (bce->queue != BUFFER_CACHE_NONE)
+      {
+          list_remove (&bce->queue_elem);
+      }
+    if (bce->queue == BUFFER_CACHE_PROBATION)
+      {
+          probation_cnt--;
+      }
+    bce->queue = queue;
+    if (queue == BUFFER_CACHE_PROBATION)
+      {
+          list_push_back (&probation_queue, &bce->queue_elem);
+          probation_cnt++;
+      }
+    else if (queue == BUFFER_CACHE_PROTECTED)
+      {
+          list_push_back (bce->meta ? &protected_meta : &protected_data,
+                          &bce->queue_elem);
+      }
+    else
+      {
+          list_push_back (&free_queue, &bce->queue_elem);
+      }
+}
+
+/* Records BLOCK_INDEX in the ghost ring, forgetting the oldest
+   ghost. */
+static void
+buffer_cache_add_ghost (block_sector_t block_index)
+{
+    struct ghost *g = &ghosts[ghost_next];
+    struct hash_elem *old;
+
+    ghost_next = (ghost_next + 1) % ghost_cnt;
+    if (g->block_index != BUFFER_CACHE_NO_OWNER)
+      {
+          hash_delete (&ghost_map, &g->hash_elem);
+      }
+    g->block_index = block_index;
+    old = hash_replace (&ghost_map, &g->hash_elem);
+    if (old != NULL)
+      {
+          hash_entry (old, struct ghost, hash_elem)->block_index
+            = BUFFER_CACHE_NO_OWNER;
+      }
+}
+
+/* Removes BLOCK_INDEX from the ghost ring, returning true if it
+   was there. */
+static bool
+buffer_cache_take_ghost (block_sector_t block_index)
+{
+    struct ghost key;
+    struct hash_elem *e;
+
+    key.block_index = block_index;
+    e = hash_delete (&ghost_map, &key.hash_elem);
+    if (e == NULL)
+      {
+          return false;
+      }
+    hash_entry (e, struct ghost, hash_elem)->block_index = BUFFER_CACHE_NO_OWNER;
+    return true;
+}
+
+/* Returns the entry caching BLOCK_INDEX, loading it into a newly
+   evicted entry on a miss if READ is true, and updates the
+   replacement queues for a reference of class META. */
+static struct buffer_cache_entry *
+buffer_cache_get (struct block *src, block_sector_t block_index, bool meta,
+                  bool read)
+{
+    ASSERT (lock_held_by_current_thread (&buffer_cache_lock));
 
     struct buffer_cache_entry *bce = buffer_cache_lookup (block_index);
-    if (bce == NULL)
+    if (bce != NULL)
+      {
+          hit_cnt++;
+          if (meta)
+            {
+                meta_hit_cnt++;
+                bce->meta = true;
+            }
+          /* A probationary data block is not promoted by hits;
+             they are usually from the same read burst. */
+          if (bce->queue == BUFFER_CACHE_PROTECTED || bce->meta)
+            {
+                buffer_cache_enqueue (bce, BUFFER_CACHE_PROTECTED);
+            }
+          return bce;
+      }
+
+    miss_cnt++;
+    if (meta)
+      {
+          meta_miss_cnt++;
+      }
+    bce = buffer_cache_evict ();
+    bce->inuse = true;
+    bce->dirty = false;
+    bce->meta = meta;
+    bce->block_index = block_index;
+    hash_insert (&buffer_cache_map, &bce->hash_elem);
+    if (buffer_cache_take_ghost (block_index))
+      {
+          ghost_hit_cnt++;
+          buffer_cache_enqueue (bce, BUFFER_CACHE_PROTECTED);
+      }
+    else
+      {
+          buffer_cache_enqueue (bce, meta ? BUFFER_CACHE_PROTECTED
+                                          : BUFFER_CACHE_PROBATION);
+      }
+    if (read)
       {
-          bce = buffer_cache_evict ();
-          bce->inuse = true;
-          bce->dirty = false;
-          bce->block_index = block_index;
           block_read (src, block_index, bce->buffer);
       }
-    bce->pinned = true;
+    return bce;
+}
+
+static void
+buffer_cache_read_class (struct block *src, block_sector_t block_index,
+                         void *buffer, bool meta)
+{
+    lock_acquire (&buffer_cache_lock);
+
+    struct buffer_cache_entry *bce = buffer_cache_get (src, block_index, meta,
+                                                       true);
     memcpy (buffer, bce->buffer, BLOCK_SECTOR_SIZE);
 
     lock_release (&buffer_cache_lock);
 }
 
+void
+buffer_cache_read(struct block *src, block_sector_t block_index, void *buffer)
+{
+    buffer_cache_read_class (src, block_index, buffer, false);
+}
+
+/* Like buffer_cache_read(), but for a metadata block, which the
+   cache keeps in preference to file data. */
+void
+buffer_cache_read_meta (struct block *src, block_sector_t block_index,
+                        void *buffer)
+{
+    buffer_cache_read_class (src, block_index, buffer, true);
+}
+
 void
 buffer_cache_write(struct block *src, block_sector_t block_index, void *buffer)
 {
-    lock_acquire (&buffer_cache_lock);
+    buffer_cache_write_owned (src, block_index, buffer, BUFFER_CACHE_NO_OWNER);
+}
 
-    struct buffer_cache_entry *bce = buffer_cache_lookup (block_index);
-    if (bce == NULL)
+/* Marks BCE dirty on behalf of the inode in sector OWNER, moving
+   it to that owner's dirty bucket.  A write with no owner leaves
+   an existing owner in place.  If the file system is journaled,
+   BCE also joins the running transaction, which journal_begin()
+   has made sure has room for it. */
+static void
+buffer_cache_mark_dirty (struct buffer_cache_entry *bce, block_sector_t owner)
+{
+    if (journal_active () && !bce->txn)
       {
-          bce = buffer_cache_evict ();
-          bce->inuse = true;
-          bce->block_index = block_index;
-          block_read (src, block_index, bce->buffer);
+          ASSERT (txn_cnt < JOURNAL_TXN_MAX);
+          bce->txn = true;
+          list_push_back (&txn_list, &bce->txn_elem);
+          txn_cnt++;
+      }
+
+    if (bce->dirty)
+      {
+          if (owner == BUFFER_CACHE_NO_OWNER || owner == bce->owner)
+            {
+                return;
+            }
+          list_remove (&bce->dirty_elem);
       }
-    bce->pinned = true;
     bce->dirty = true;
+    bce->owner = owner;
+    list_push_back (dirty_bucket (owner), &bce->dirty_elem);
+}
+
+static void
+buffer_cache_write_class (struct block *src, block_sector_t block_index,
+                          const void *buffer, block_sector_t owner, bool meta)
+{
+    lock_acquire (&buffer_cache_lock);
+
+    struct buffer_cache_entry *bce = buffer_cache_get (src, block_index, meta,
+                                                       false);
+    buffer_cache_mark_dirty (bce, owner);
     memcpy (bce->buffer, buffer, BLOCK_SECTOR_SIZE);
 
     lock_release (&buffer_cache_lock);
 }
 
-struct buffer_cache_entry *
-buffer_cache_evict()
+/* Like buffer_cache_write(), but records that the block belongs
+   to the inode in sector OWNER so that buffer_cache_flush_owner()
+   can find it.  The whole sector is overwritten, so a miss does
+   not read the old contents from disk. */
+void
+buffer_cache_write_owned(struct block *src, block_sector_t block_index,
+                         const void *buffer, block_sector_t owner)
 {
-    ASSERT (lock_held_by_current_thread (&buffer_cache_lock));
-    /* Check whether there are any unused cache */
-    for (int i = 0; i < BUFFER_CACHE_SIZE; i++)
+    buffer_cache_write_class (src, block_index, buffer, owner, false);
+}
+
+/* Like buffer_cache_write_owned(), but for a metadata block. */
+void
+buffer_cache_write_meta (struct block *src, block_sector_t block_index,
+                         const void *buffer, block_sector_t owner)
+{
+    buffer_cache_write_class (src, block_index, buffer, owner, true);
+}
+
+/* Zero-fills newly allocated metadata sector BLOCK_INDEX, an
+   index or directory block, on behalf of the inode in sector
+   OWNER.  The zeros are only put in the cache and reach the disk
+   when the entry is flushed.  Like any metadata, the entry goes
+   on the protected queue. */
+void
+buffer_cache_zero (struct block *src, block_sector_t block_index,
+                   block_sector_t owner)
+{
+    lock_acquire (&buffer_cache_lock);
+
+    struct buffer_cache_entry *bce = buffer_cache_get (src, block_index, true,
+                                                       false);
+    buffer_cache_mark_dirty (bce, owner);
+    memset (bce->buffer, 0, BLOCK_SECTOR_SIZE);
+
+    lock_release (&buffer_cache_lock);
+}
+
+/* Drops sector BLOCK_INDEX, which has been freed, from the cache
+   without writing it back, so that a stale copy cannot later be
+   written over the sector's next use. */
+void
+buffer_cache_discard (block_sector_t block_index)
+{
+    lock_acquire (&buffer_cache_lock);
+
+    struct buffer_cache_entry *bce = buffer_cache_lookup (block_index);
+    if (bce != NULL)
       {
-          if (!buffer_cache_list[clock_pin].inuse)
+          if (bce->dirty)
             {
-                return &buffer_cache_list[clock_pin];
+                list_remove (&bce->dirty_elem);
+                bce->dirty = false;
             }
-      }
-    /* Clock algorithm */
-    while (true)
-      {
-          if (!buffer_cache_list[clock_pin].pinned)
+          if (bce->txn)
             {
-                break;
+                list_remove (&bce->txn_elem);
+                bce->txn = false;
+                txn_cnt--;
             }
-          else
+          hash_delete (&buffer_cache_map, &bce->hash_elem);
+          bce->inuse = false;
+          buffer_cache_enqueue (bce, BUFFER_CACHE_FREE);
+      }
+
+    lock_release (&buffer_cache_lock);
+}
+
+/* Returns the entry nearest the front of QUEUE that is not in the
+   running transaction, or a null pointer if there is none.  At
+   most JOURNAL_TXN_MAX entries are passed over. */
+static struct buffer_cache_entry *
+buffer_cache_first_unpinned (struct list *queue)
+{
+    struct list_elem *e;
+
+    for (e = list_begin (queue); e != list_end (queue); e = list_next (e))
+      {
+          struct buffer_cache_entry *bce = list_entry (e, struct buffer_cache_entry,
+                                                       queue_elem);
+          if (!bce->txn)
             {
-                buffer_cache_list[clock_pin].pinned = false;
+                return bce;
             }
-          clock_pin = (clock_pin + 1) % BUFFER_CACHE_SIZE;
       }
-    if (buffer_cache_list[clock_pin].dirty)
+    return NULL;
+}
+
+/* Picks an entry to reuse, writing it back first if it is dirty,
+   and returns it unused and off every queue.  Probation gives up
+   its oldest block when it is over its target size; otherwise the
+   protected queue gives up its least recently used data block, or
+   its least recently used block if it holds only metadata.
+   Blocks of the running transaction are never chosen: they may
+   not be written home until it commits, and committing here could
+   split an operation in two. */
+struct buffer_cache_entry *
+buffer_cache_evict()
+{
+    ASSERT (lock_held_by_current_thread (&buffer_cache_lock));
+    struct buffer_cache_entry *bce = NULL;
+
+    if (!list_empty (&free_queue) || buffer_cache_grow (false))
+      {
+          bce = list_entry (list_pop_front (&free_queue),
+                            struct buffer_cache_entry, queue_elem);
+          bce->queue = BUFFER_CACHE_NONE;
+          return bce;
+      }
+
+    if (probation_cnt > PROBATION_TARGET
+        || (list_empty (&protected_data) && list_empty (&protected_meta)))
+      {
+          bce = buffer_cache_first_unpinned (&probation_queue);
+      }
+    if (bce == NULL)
+      {
+          bce = buffer_cache_first_unpinned (&protected_data);
+      }
+    if (bce == NULL)
+      {
+          bce = buffer_cache_first_unpinned (&protected_meta);
+      }
+    if (bce == NULL)
+      {
+          bce = buffer_cache_first_unpinned (&probation_queue);
+      }
+    ASSERT (bce != NULL);
+    if (bce->queue == BUFFER_CACHE_PROBATION)
+      {
+          buffer_cache_add_ghost (bce->block_index);
+      }
+
+    evict_cnt++;
+    if (bce->dirty)
+      {
+          writeback_cnt++;
+          buffer_cache_flush (bce);
+      }
+    if (bce->queue == BUFFER_CACHE_PROBATION)
       {
-          buffer_cache_flush (&buffer_cache_list[clock_pin]);
+          probation_cnt--;
       }
-    buffer_cache_list[clock_pin].inuse = false;
-    return &buffer_cache_list[clock_pin];
+    list_remove (&bce->queue_elem);
+    hash_delete (&buffer_cache_map, &bce->hash_elem);
+    bce->queue = BUFFER_CACHE_NONE;
+    bce->inuse = false;
+    return bce;
+}
+
+/* Prints buffer cache statistics. */
+void
+buffer_cache_print_stats (void)
+{
+    long long total = hit_cnt + miss_cnt;
+    long long meta_total = meta_hit_cnt + meta_miss_cnt;
+
+    printf ("Buffer cache: %zu of up to %zu sectors, %lld shrinks\n",
+            backed_cnt, capacity, shrink_cnt);
+    printf ("Buffer cache: %lld hits, %lld misses (%lld%% hit rate), "
+            "%lld evictions, %lld write-backs\n",
+            hit_cnt, miss_cnt, total ? hit_cnt * 100 / total : 0,
+            evict_cnt, writeback_cnt);
+    printf ("  metadata: %lld hits, %lld misses (%lld%% hit rate); "
+            "%lld ghost hits\n",
+            meta_hit_cnt, meta_miss_cnt,
+            meta_total ? meta_hit_cnt * 100 / meta_total : 0, ghost_hit_cnt);
 }
 
 void
@@ -120,7 +812,11 @@ buffer_cache_flush(struct buffer_cache_entry * bce)
     ASSERT (lock_held_by_current_thread (&buffer_cache_lock));
     ASSERT (bce->inuse);
 
+    /* Write-ahead: a block goes home only after the journal has
+       it. */
+    ASSERT (!bce->txn);
     block_write (fs_device, bce->block_index, bce->buffer);
+    list_remove (&bce->dirty_elem);
     bce->dirty = false;
 }
 
@@ -128,15 +824,10 @@ struct buffer_cache_entry *
 buffer_cache_lookup(block_sector_t block_index)
 {
     ASSERT (lock_held_by_current_thread (&buffer_cache_lock));
-    struct buffer_cache_entry * bce = NULL;
-    for (int i = 0; i < BUFFER_CACHE_SIZE; i++)
-      {
-          if (buffer_cache_list[i].block_index == block_index \
-              && buffer_cache_list[i].inuse == true)
-            {
-                bce = &buffer_cache_list[i];
-            }
-      }
+    struct buffer_cache_entry key;
+    struct hash_elem *e;
 
-    return bce;
-}
\ No newline at end of file
+    key.block_index = block_index;
+    e = hash_find (&buffer_cache_map, &key.hash_elem);
+    return e != NULL ? hash_entry (e, struct buffer_cache_entry, hash_elem) : NULL;
+}
@@ -5,27 +5,65 @@
 #include "threads/synch.h"
 #include "filesys/filesys.h"
 #include "lib/debug.h"
+#include <hash.h>
 #include <string.h>
 
-#define BUFFER_CACHE_SIZE 64
+#define BUFFER_CACHE_MIN 128                /* Never shrink below this;
+                                               twice JOURNAL_TXN_MAX */
+#define BUFFER_CACHE_DEFAULT_SHARE 16       /* Default max: 1/16 of kernel pool;
+                                               file data is in the page cache */
+#define BUFFER_CACHE_DIRTY_BUCKETS 16       /* Dirty lists, hashed by owner */
+#define BUFFER_CACHE_NO_OWNER ((block_sector_t) -1)
+
+/* Replacement queue an entry is on. */
+enum buffer_cache_queue
+{
+    BUFFER_CACHE_NONE,                  /* On no queue */
+    BUFFER_CACHE_FREE,                  /* Unused */
+    BUFFER_CACHE_PROBATION,             /* Data referenced once, FIFO */
+    BUFFER_CACHE_PROTECTED              /* Re-referenced or metadata, LRU */
+};
 
 struct buffer_cache_entry
 {
     bool inuse;                         /* whether this block is used */
-    bool pinned;                        /* Used for evition */
     bool dirty;                         /* Used for flush */
+    bool meta;                          /* Inode, index or directory block */
+    bool txn;                           /* In the running transaction */
+    enum buffer_cache_queue queue;      /* Replacement queue */
 
     block_sector_t block_index;         /* block location */
-    uint8_t buffer[BLOCK_SECTOR_SIZE];  /* contents */
+    block_sector_t owner;               /* Inode sector this block belongs to */
+    struct list_elem dirty_elem;        /* Owner's dirty bucket, while dirty */
+    struct list_elem queue_elem;        /* Replacement queue element */
+    struct list_elem txn_elem;          /* Running transaction, while txn */
+    struct hash_elem hash_elem;         /* Lookup table, while inuse */
+    uint8_t *buffer;                    /* contents, null if unbacked */
 };
 
-void buffer_cache_init (void);
+void buffer_cache_init (size_t max_sectors);
 void buffer_cache_close (void);
 void buffer_cache_read (struct block *block, block_sector_t block_index, void *buffer);
+void buffer_cache_read_meta (struct block *block, block_sector_t block_index,
+                             void *buffer);
 void buffer_cache_write (struct block *block, block_sector_t block_index, void *buffer);
+void buffer_cache_write_owned (struct block *block, block_sector_t block_index,
+                               const void *buffer, block_sector_t owner);
+void buffer_cache_write_meta (struct block *block, block_sector_t block_index,
+                              const void *buffer, block_sector_t owner);
+void buffer_cache_zero (struct block *block, block_sector_t block_index,
+                        block_sector_t owner);
+void buffer_cache_discard (block_sector_t block_index);
+void buffer_cache_flush_owner (block_sector_t owner);
+void buffer_cache_flush_all (void);
+void buffer_cache_commit (void);
+void buffer_cache_checkpoint (void);
+size_t buffer_cache_txn_size (void);
+void buffer_cache_print_stats (void);
+bool buffer_cache_shrink (void);
 
 struct buffer_cache_entry *buffer_cache_evict (void);
 void buffer_cache_flush (struct buffer_cache_entry *);
 struct buffer_cache_entry *buffer_cache_lookup (block_sector_t block_index);
 
-#endif
\ No newline at end of file
+#endif
@@ -5,6 +5,7 @@
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 
 /* A directory. */
@@ -22,6 +23,19 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Number of entries dir_getdents() reads at once. */
+#define GETDENTS_BATCH 128
+
+/* Cache for struct dir. */
+static struct kmem_cache *dir_cache;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  dir_cache = kmem_cache_create ("dir", sizeof (struct dir), NULL);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -35,7 +49,7 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
+  struct dir *dir = kmem_cache_alloc (dir_cache);
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
@@ -45,7 +59,7 @@ dir_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
       return NULL; 
     }
 }
@@ -73,7 +87,7 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
     }
 }
 
@@ -240,6 +254,52 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
   return false;
 }
 
+/* Reads up to CNT in-use entries of DIR, starting at its current
+   position, into ENTS.  Returns the number read, which is 0 at
+   the end of the directory, or -1 if memory runs out.  The
+   directory is read up to GETDENTS_BATCH entries at a time
+   rather than one, but never more than are still wanted, so that
+   no entry is read twice by successive calls. */
+int
+dir_getdents (struct dir *dir, struct dirent *ents, int cnt)
+{
+  struct dir_entry *batch;
+  int n = 0;
+
+  if (cnt <= 0)
+    return 0;
+  batch = malloc ((cnt < GETDENTS_BATCH ? cnt : GETDENTS_BATCH)
+                  * sizeof *batch);
+  if (batch == NULL)
+    return -1;
+
+  while (n < cnt)
+    {
+      int want = cnt - n < GETDENTS_BATCH ? cnt - n : GETDENTS_BATCH;
+      off_t bytes = inode_read_at (dir->inode, batch, want * sizeof *batch,
+                                   dir->pos);
+      size_t entry_cnt = bytes / sizeof *batch;
+      size_t i;
+
+      if (entry_cnt == 0)
+        break;
+      for (i = 0; i < entry_cnt && n < cnt; i++)
+        if (batch[i].in_use)
+          {
+            struct dirent *d = &ents[n++];
+            struct inode *inode = inode_open (batch[i].inode_sector);
+
+            d->inumber = batch[i].inode_sector;
+            d->is_dir = inode != NULL && inode_is_dir (inode);
+            strlcpy (d->name, batch[i].name, sizeof d->name);
+            inode_close (inode);
+          }
+      dir->pos += i * sizeof *batch;
+    }
+  free (batch);
+  return n;
+}
+
 struct dir *
 dir_get_directory (const char *path)
 {
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <dirent.h>
 #include "devices/block.h"
 
 /* Maximum length of a file name component.
@@ -13,6 +14,8 @@
 
 struct inode;
 
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -26,6 +29,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+int dir_getdents (struct dir *, struct dirent *, int cnt);
 bool dir_isdir (struct dir *, char name[NAME_MAX + 1]);
 
 /* Tools */
@@ -113,6 +113,43 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Forces FILE's modified data and metadata out to disk. */
+void
+file_flush (struct file *file) 
+{
+  ASSERT (file != NULL);
+  inode_flush (file->inode);
+}
+
+/* Allocates disk space for the first LENGTH bytes of FILE,
+   extending it to LENGTH bytes if it is shorter.  Returns true if
+   successful. */
+bool
+file_allocate (struct file *file, off_t length) 
+{
+  ASSERT (file != NULL);
+  return inode_reserve (file->inode, length);
+}
+
+/* Sets FILE's length to LENGTH bytes, zero-filling or discarding
+   data at the end.  Returns true if successful. */
+bool
+file_truncate (struct file *file, off_t length) 
+{
+  ASSERT (file != NULL);
+  return inode_truncate (file->inode, length);
+}
+
+/* Turns the SIZE bytes of FILE starting at OFFSET into a hole,
+   freeing the disk space behind them, without changing FILE's
+   length.  Returns true if successful. */
+bool
+file_punch (struct file *file, off_t offset, off_t size) 
+{
+  ASSERT (file != NULL);
+  return inode_punch (file->inode, offset, size);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -6,6 +6,9 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/cache.h"
+#include "filesys/page-cache.h"
+#include "filesys/journal.h"
 #include "threads/thread.h"
 
 /* Partition that contains the file system. */
@@ -23,11 +26,13 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
+  journal_init ();
   free_map_open ();
 }
 
@@ -38,10 +43,21 @@ filesys_done (void)
 {
   // filesys_remove ("fs.tar");
   fsutil_ls ();
-  buffer_cache_close ();
+  page_cache_flush_all ();
   free_map_close ();
+  journal_done ();
+  buffer_cache_close ();
 }
 
+/* Writes all modified file system data to disk. */
+void
+filesys_sync (void) 
+{
+  page_cache_flush_all ();
+  journal_commit ();
+  buffer_cache_flush_all ();
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -57,17 +73,26 @@ filesys_create (const char *path, off_t initial_size, int type)
   // printf ("path is %s, filename is %s, address of dir is %p\n", path, name, dir);
 
   block_sector_t inode_sector = 0;
+  block_sector_t goal = 0;
+
+  /* Put files near their directory, and new directories in the
+     emptiest part of the disk. */
+  if (dir != NULL)
+    goal = (type == DIR ? free_map_dir_goal ()
+            : inode_get_inumber (dir_get_inode (dir)));
   // if (type == DIR && name == NULL)
   //   {
   //     return false;
   //   }
   // struct dir *dir = dir_open_root ();
+  journal_begin ();
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (1, goal, &inode_sector)
                   && inode_create (inode_sector, initial_size, type)
                   && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
+  journal_end ();
   // printf ("%s is added at sector inode sector %d\n", name, inode_sector);
   dir_close (dir);
 
@@ -139,7 +164,9 @@ filesys_remove (const char *path)
       return NULL;
     }
 
+  journal_begin ();
   bool success = dir != NULL && dir_remove (dir, name);
+  journal_end ();
   dir_close (dir); 
 
   return success;
@@ -198,5 +225,7 @@ do_format (void)
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
+  buffer_cache_flush_all ();
+  journal_format ();
   printf ("done.\n");
 }
@@ -7,6 +7,7 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* Journal header, followed by the log. */
 
 #define DIR 0
 #define FILE 1
@@ -16,6 +17,7 @@ extern struct block *fs_device;
 
 void filesys_init (bool format);
 void filesys_done (void);
+void filesys_sync (void);
 bool filesys_create (const char *name, off_t initial_size, int type);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
@@ -1,13 +1,35 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors released while the journal might still hold copies of
+   them.  They stay allocated until the log has started over
+   since, so that replay cannot write stale metadata over their
+   next use. */
+static struct bitmap *released;
+static size_t released_cnt;
+static unsigned released_generation;
+
+/* Allocation policy.  The disk is divided into groups of
+   FREE_MAP_GROUP_SIZE sectors.  New directories go in the group
+   with the most free space, and other inodes go near their
+   parent directory, so that unrelated trees stay apart.  File
+   data goes right after the file's previous block.  When that
+   sector is taken, typically by another file growing at the same
+   time, the file starts over at the next wholly free cluster of
+   FREE_MAP_CLUSTER sectors, so that concurrent writers alternate
+   in cluster-sized runs instead of single sectors. */
+#define FREE_MAP_GROUP_SIZE 512
+#define FREE_MAP_CLUSTER 16
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -17,6 +39,31 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  if (journal_fits ())
+    bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS + 1, true);
+
+  released = bitmap_create (block_size (fs_device));
+  if (released == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+}
+
+/* Frees the sectors in RELEASED, if FORCE is true or the log has
+   started over since they were released. */
+static void
+reap_released (bool force)
+{
+  size_t sector;
+
+  if (released_cnt == 0
+      || (!force && journal_generation () == released_generation))
+    return;
+
+  for (sector = bitmap_scan (released, 0, 1, true);
+       sector != BITMAP_ERROR;
+       sector = bitmap_scan (released, sector + 1, 1, true))
+    bitmap_reset (free_map, sector);
+  bitmap_set_all (released, false);
+  released_cnt = 0;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,28 +74,134 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Marks the CNT sectors starting at SECTOR, which must be free,
+   as allocated and writes the free map back.  Stores SECTOR in
+   *SECTORP and returns true if successful.  SECTOR may be
+   BITMAP_ERROR, in which case this just returns false. */
+static bool
+claim (size_t sector, size_t cnt, block_sector_t *sectorp)
+{
+  if (sector == BITMAP_ERROR)
+    return false;
+
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  if (free_map_file != NULL && !bitmap_write (free_map, free_map_file))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      return false;
+    }
+  *sectorp = sector;
+  return true;
+}
+
+/* Like free_map_allocate(), but takes the first run of CNT free
+   sectors at or after GOAL, wrapping around to the start of the
+   disk if there is none. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  size_t sector;
+
+  reap_released (false);
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  sector = bitmap_scan (free_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR && goal > 0)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+  return claim (sector, cnt, sectorp);
+}
+
+/* Allocates one sector of file data, ideally GOAL, the sector
+   after the file's previous block.  If GOAL is taken, uses the
+   start of the first wholly free cluster after it, and failing
+   that any free sector near it.  Stores the sector in *SECTORP
+   and returns true if successful. */
+bool
+free_map_allocate_data (block_sector_t goal, block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start;
+
+  reap_released (false);
+  if (goal < size && !bitmap_test (free_map, goal))
+    return claim (goal, 1, sectorp);
+
+  for (start = ROUND_UP (goal, FREE_MAP_CLUSTER);
+       start + FREE_MAP_CLUSTER <= size; start += FREE_MAP_CLUSTER)
+    if (bitmap_none (free_map, start, FREE_MAP_CLUSTER))
+      return claim (start, 1, sectorp);
+
+  return free_map_allocate_near (1, goal, sectorp);
+}
+
+/* Returns a goal sector for a new directory's inode: the start of
+   the group with the most free sectors. */
+block_sector_t
+free_map_dir_goal (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t best = 0, best_free = 0;
+  size_t start;
+
+  for (start = 0; start < size; start += FREE_MAP_GROUP_SIZE)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      size_t cnt = size - start < FREE_MAP_GROUP_SIZE
+                   ? size - start : FREE_MAP_GROUP_SIZE;
+      size_t free_cnt = bitmap_count (free_map, start, cnt, false);
+      if (free_cnt > best_free)
+        {
+          best = start;
+          best_free = free_cnt;
+        }
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  return best;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Returns the number of free sectors. */
+size_t
+free_map_free_cnt (void)
+{
+  reap_released (false);
+  return bitmap_count (free_map, 0, bitmap_size (free_map), false);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, at
+   once if the file system is not journaled and otherwise once
+   the log has started over. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
+  if (journal_active ())
+    {
+      ASSERT (bitmap_none (released, sector, cnt));
+      bitmap_set_multiple (released, sector, cnt, true);
+      released_cnt += cnt;
+      released_generation = journal_generation ();
+      return;
+    }
   bitmap_set_multiple (free_map, sector, cnt, false);
   bitmap_write (free_map, free_map_file);
 }
 
+/* Makes the sectors released since the log last started over
+   available at once, by checkpointing the journal, for when the
+   disk looks full.  Must be called outside any journal operation;
+   inside one, does nothing.  Returns true if any sectors were
+   made available. */
+bool
+free_map_reclaim (void)
+{
+  if (released_cnt == 0 || !journal_checkpoint ())
+    return false;
+  reap_released (false);
+  return true;
+}
+
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void) 
@@ -64,6 +217,11 @@ free_map_open (void)
 void
 free_map_close (void) 
 {
+  if (released_cnt > 0)
+    {
+      reap_released (true);
+      bitmap_write (free_map, free_map_file);
+    }
   file_close (free_map_file);
 }
 
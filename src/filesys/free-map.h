@@ -12,6 +12,11 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (size_t, block_sector_t goal, block_sector_t *);
+bool free_map_allocate_data (block_sector_t goal, block_sector_t *);
+block_sector_t free_map_dir_goal (void);
+size_t free_map_free_cnt (void);
 void free_map_release (block_sector_t, size_t);
+bool free_map_reclaim (void);
 
 #endif /* filesys/free-map.h */
@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -68,21 +70,191 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Sequential access to the scratch device in large chunks.
+
+   A stream owns two buffers of STREAM_SECTORS sectors each.
+   While the caller works on one buffer, the other one is being
+   read from (or written to) the device in the background, so
+   that device and CPU time overlap. */
+
+/* Sectors per buffer, and thus per block device request. */
+#define STREAM_SECTORS 64
+#define STREAM_PAGES (STREAM_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE)
+
+struct stream
+  {
+    struct block *block;        /* Device. */
+    block_sector_t next;        /* Next sector to transfer. */
+    block_sector_t pos;         /* Reading: next sector to be used. */
+    uint8_t *bufs[2];           /* Buffers. */
+    struct bio bios[2];         /* Transfer for each buffer. */
+    bool pending[2];            /* Is bios[i] submitted but not done? */
+    size_t cnt[2];              /* Reading: sectors in bufs[i]. */
+    int cur;                    /* Buffer the caller is using. */
+    size_t ofs;                 /* Sectors used in bufs[cur]. */
+  };
+
+/* Starts an asynchronous read of the next chunk of S's device
+   into buffer I.  Past the end of the device, buffer I is left
+   empty. */
+static void
+stream_fill (struct stream *s, int i)
+{
+  block_sector_t size = block_size (s->block);
+
+  s->cnt[i] = s->next < size ? size - s->next : 0;
+  if (s->cnt[i] > STREAM_SECTORS)
+    s->cnt[i] = STREAM_SECTORS;
+  if (s->cnt[i] > 0)
+    {
+      bio_init (&s->bios[i], s->next, s->bufs[i], s->cnt[i], false);
+      block_submit (s->block, &s->bios[i]);
+      s->pending[i] = true;
+      s->next += s->cnt[i];
+    }
+}
+
+/* Waits for buffer I of S to be transferred, if it is pending. */
+static void
+stream_wait (struct stream *s, int i)
+{
+  if (s->pending[i])
+    {
+      block_wait (s->block, &s->bios[i]);
+      s->pending[i] = false;
+    }
+}
+
+/* Opens stream S on BLOCK starting at SECTOR.  If READ is true,
+   starts reading ahead right away. */
+static void
+stream_open (struct stream *s, struct block *block, block_sector_t sector,
+             bool read)
+{
+  int i;
+
+  s->block = block;
+  s->next = sector;
+  s->pos = sector;
+  s->cur = 0;
+  s->ofs = 0;
+  for (i = 0; i < 2; i++)
+    {
+      s->bufs[i] = palloc_get_multiple (PAL_ASSERT, STREAM_PAGES);
+      s->pending[i] = false;
+      s->cnt[i] = 0;
+    }
+  if (read)
+    for (i = 0; i < 2; i++)
+      stream_fill (s, i);
+}
+
+/* Returns the next unread sectors of read stream S and stores
+   how many there are, at least 1, in *CNT. */
+static const uint8_t *
+stream_peek (struct stream *s, size_t *cnt)
+{
+  stream_wait (s, s->cur);
+  if (s->ofs >= s->cnt[s->cur])
+    PANIC ("unexpected end of scratch device");
+  *cnt = s->cnt[s->cur] - s->ofs;
+  return s->bufs[s->cur] + s->ofs * BLOCK_SECTOR_SIZE;
+}
+
+/* Marks CNT sectors returned by stream_peek() as read.  Once a
+   buffer is used up, starts reading the next chunk into it. */
+static void
+stream_advance (struct stream *s, size_t cnt)
+{
+  s->ofs += cnt;
+  s->pos += cnt;
+  ASSERT (s->ofs <= s->cnt[s->cur]);
+  if (s->ofs == s->cnt[s->cur])
+    {
+      stream_fill (s, s->cur);
+      s->cur = !s->cur;
+      s->ofs = 0;
+    }
+}
+
+/* Starts writing the filled part of write stream S's current
+   buffer and switches to the other buffer. */
+static void
+stream_flush (struct stream *s)
+{
+  int i = s->cur;
+
+  if (s->ofs == 0)
+    return;
+  if (s->next + s->ofs > block_size (s->block))
+    PANIC ("out of space on scratch device");
+  bio_init (&s->bios[i], s->next, s->bufs[i], s->ofs, true);
+  block_submit (s->block, &s->bios[i]);
+  s->pending[i] = true;
+  s->next += s->ofs;
+  s->cur = !i;
+  s->ofs = 0;
+}
+
+/* Returns space for the next sectors of write stream S and
+   stores how many sectors there is room for, at least 1, in
+   *CNT. */
+static uint8_t *
+stream_reserve (struct stream *s, size_t *cnt)
+{
+  stream_wait (s, s->cur);
+  *cnt = STREAM_SECTORS - s->ofs;
+  return s->bufs[s->cur] + s->ofs * BLOCK_SECTOR_SIZE;
+}
+
+/* Marks CNT sectors returned by stream_reserve() as filled in.
+   Once a buffer is full, starts writing it. */
+static void
+stream_commit (struct stream *s, size_t cnt)
+{
+  s->ofs += cnt;
+  ASSERT (s->ofs <= STREAM_SECTORS);
+  if (s->ofs == STREAM_SECTORS)
+    stream_flush (s);
+}
+
+/* Closes stream S, first writing anything buffered if it is a
+   write stream and waiting for all transfers to finish.
+   Returns the sector following the last one written. */
+static block_sector_t
+stream_close (struct stream *s, bool write)
+{
+  int i;
+
+  if (write)
+    stream_flush (s);
+  for (i = 0; i < 2; i++)
+    {
+      stream_wait (s, i);
+      palloc_free_multiple (s->bufs[i], STREAM_PAGES);
+    }
+  return s->next;
+}
+
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system.
+
+   The archive is read in large chunks, with the next chunk
+   already on its way while the current one is copied, and each
+   file is created at its full size, with all of its blocks
+   allocated in as few contiguous runs as possible, before any
+   data is written, so that writes never have to allocate. */
 void
 fsutil_extract (char **argv UNUSED) 
 {
-  static block_sector_t sector = 0;
-
   struct block *src;
-  void *header, *data;
+  struct stream stream;
+  void *header;
 
-  /* Allocate buffers. */
+  /* Allocate buffer. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
-  if (header == NULL || data == NULL)
-    PANIC ("couldn't allocate buffers");
+  if (header == NULL)
+    PANIC ("couldn't allocate buffer");
 
   /* Open source block device. */
   src = block_get_role (BLOCK_SCRATCH);
@@ -92,18 +264,22 @@ fsutil_extract (char **argv UNUSED)
   printf ("Extracting ustar archive from scratch device "
           "into file system...\n");
 
+  stream_open (&stream, src, 0, true);
   for (;;)
     {
       const char *file_name;
       const char *error;
       enum ustar_type type;
+      block_sector_t sector = stream.pos;
+      size_t cnt;
       int size;
 
       /* Read and parse ustar header. */
-      block_read (src, sector++, header);
+      memcpy (header, stream_peek (&stream, &cnt), BLOCK_SECTOR_SIZE);
+      stream_advance (&stream, 1);
       error = ustar_parse_header (header, &file_name, &type, &size);
       if (error != NULL)
-        PANIC ("bad ustar header in sector %"PRDSNu" (%s)", sector - 1, error);
+        PANIC ("bad ustar header in sector %"PRDSNu" (%s)", sector, error);
 
       if (type == USTAR_EOF)
         {
@@ -118,23 +294,28 @@ fsutil_extract (char **argv UNUSED)
 
           printf ("Putting '%s' into the file system...\n", file_name);
 
-          /* Create destination file. */
+          /* Create destination file at its full size.  New files
+             are sparse, so allocate its blocks too. */
           if (!filesys_create (file_name, size, FILE))
             PANIC ("%s: create failed", file_name);
           dst = filesys_open (file_name);
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
+          if (!file_allocate (dst, size))
+            PANIC ("%s: allocation failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, as many sectors at a time as are buffered. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
+              const uint8_t *data = stream_peek (&stream, &cnt);
+              int chunk_size = (size > (int) (cnt * BLOCK_SECTOR_SIZE)
+                                ? (int) (cnt * BLOCK_SECTOR_SIZE)
                                 : size);
-              block_read (src, sector++, data);
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
+              stream_advance (&stream,
+                              DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE));
               size -= chunk_size;
             }
 
@@ -142,6 +323,7 @@ fsutil_extract (char **argv UNUSED)
           file_close (dst);
         }
     }
+  stream_close (&stream, false);
 
   /* Erase the ustar header from the start of the block device,
      so that the extraction operation is idempotent.  We erase
@@ -152,9 +334,88 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
   free (header);
-  // filesys_remove ("fs.tar");
+}
+
+/* Writes every regular file in the root directory to the scratch
+   device as a ustar archive, starting at the beginning of the
+   device.  This does the work of one `append' per file, but
+   streams the whole archive out in large chunks. */
+void
+fsutil_archive (char **argv UNUSED)
+{
+  char name[NAME_MAX + 1];
+  struct stream stream;
+  struct block *dst;
+  struct dir *dir;
+  uint8_t *p;
+  size_t cnt;
+  int i;
+
+  printf ("Archiving root directory to ustar archive on scratch device...\n");
+
+  dst = block_get_role (BLOCK_SCRATCH);
+  if (dst == NULL)
+    PANIC ("couldn't open scratch device");
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("root dir open failed");
+
+  stream_open (&stream, dst, 0, false);
+  while (dir_readdir (dir, name))
+    {
+      struct inode *inode;
+      struct file *src;
+      off_t size;
+
+      if (!dir_lookup (dir, name, &inode))
+        continue;
+      if (inode_is_dir (inode))
+        {
+          inode_close (inode);
+          continue;
+        }
+      src = file_open (inode);
+      if (src == NULL)
+        PANIC ("%s: open failed", name);
+      size = file_length (src);
+      printf ("Archiving '%s'...\n", name);
+
+      /* Header. */
+      p = stream_reserve (&stream, &cnt);
+      if (!ustar_make_header (name, USTAR_REGULAR, size, (char *) p))
+        PANIC ("%s: name too long for ustar format", name);
+      stream_commit (&stream, 1);
+
+      /* Data, zero-padded to a whole number of sectors. */
+      while (size > 0)
+        {
+          off_t chunk_size;
+
+          p = stream_reserve (&stream, &cnt);
+          chunk_size = (size > (off_t) (cnt * BLOCK_SECTOR_SIZE)
+                        ? (off_t) (cnt * BLOCK_SECTOR_SIZE)
+                        : size);
+          if (file_read (src, p, chunk_size) != chunk_size)
+            PANIC ("%s: read failed with %"PROTd" bytes unread", name, size);
+          memset (p + chunk_size, 0,
+                  ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE) - chunk_size);
+          stream_commit (&stream,
+                         DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE));
+          size -= chunk_size;
+        }
+      file_close (src);
+    }
+  dir_close (dir);
+
+  /* Write ustar end-of-archive marker, two sectors of zeros. */
+  for (i = 0; i < 2; i++)
+    {
+      p = stream_reserve (&stream, &cnt);
+      memset (p, 0, BLOCK_SECTOR_SIZE);
+      stream_commit (&stream, 1);
+    }
+  stream_close (&stream, true);
 }
 
 /* Copies file FILE_NAME from the file system to the scratch
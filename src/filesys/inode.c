@@ -2,11 +2,15 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdint.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "filesys/cache.h"
+#include "filesys/page-cache.h"
+#include "filesys/journal.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -17,6 +21,31 @@
 #define LAYER_1 DIRECT_BN + INDIRECT_BN
 #define LAYER_2 DIRECT_BN + INDIRECT_BN + INDIRECT_BN * INDIRECT_BN
 
+/* Inode flags. */
+#define INODE_INLINE 0x1        /* Data is stored in inline_data. */
+
+/* Bytes of file data that fit in the inode sector itself. */
+#define INODE_INLINE_SIZE 436
+
+/* Blocks of a regular file that one journaled step of a big
+   write, fallocate or hole punch covers.  A step dirties the
+   inode, the indirect and double indirect blocks, and at most
+   one index block per INDIRECT_BN blocks plus one where it
+   starts partway into one, well within JOURNAL_OP_BLOCKS.
+   Directory and free map contents are journaled themselves, so
+   their steps are smaller. */
+#define STEP_BLOCKS (8 * INDIRECT_BN)
+
+/* Longest a file may be, LAYER_2 - 1 blocks, the most that
+   allocation handles. */
+#define INODE_MAX_LENGTH ((off_t) ((LAYER_2) - 1) * BLOCK_SECTOR_SIZE)
+#define META_STEP_BLOCKS (JOURNAL_OP_BLOCKS / 2)
+
+/* A block pointer to a block that has never been written, which
+   reads as zeros.  Sector 0 holds the free map inode, so it is
+   never a file block. */
+#define HOLE 0
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
@@ -29,7 +58,8 @@ struct inode_disk
     int inode_type;                         /* necessary */
     off_t length;                           /* File size in bytes. */
     unsigned magic;                         /* Magic number. */
-    uint32_t unused[110];                   /* Not used. */
+    uint32_t flags;                         /* INODE_* flags. */
+    uint8_t inline_data[INODE_INLINE_SIZE]; /* Data, if INODE_INLINE. */
   };
 
 struct indirect_inode_disk
@@ -60,7 +90,8 @@ struct inode
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS, or HOLE if the byte is in a block that has never been
+   written. */
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
@@ -85,18 +116,24 @@ byte_to_sector (const struct inode *inode, off_t pos)
   else if (index < LAYER_1)
     {
       struct indirect_inode_disk iid;
-      buffer_cache_read (fs_device, inode->data.indirect_pointer, &iid);
+      if (inode->data.indirect_pointer == HOLE)
+        return HOLE;
+      buffer_cache_read_meta (fs_device, inode->data.indirect_pointer, &iid);
       // printf ("what we want is %d\n", iid.blocks[index - LAYER_0]);
       return iid.blocks[index-LAYER_0];
     }
   else if (index < LAYER_2)
     {
       struct indirect_inode_disk double_iid;
-      buffer_cache_read (fs_device, inode->data.double_indirect_pointer, &double_iid);
+      if (inode->data.double_indirect_pointer == HOLE)
+        return HOLE;
+      buffer_cache_read_meta (fs_device, inode->data.double_indirect_pointer, &double_iid);
       int location = (index - LAYER_1)/INDIRECT_BN;
       int offset = (index - LAYER_1)%INDIRECT_BN;
       struct indirect_inode_disk iid;
-      buffer_cache_read (fs_device, double_iid.blocks[location], &iid);
+      if (double_iid.blocks[location] == HOLE)
+        return HOLE;
+      buffer_cache_read_meta (fs_device, double_iid.blocks[location], &iid);
       return iid.blocks[offset];
     }
   else
@@ -104,22 +141,59 @@ byte_to_sector (const struct inode *inode, off_t pos)
       return -1;
     }
 }
+/* Where allocate_block() puts new blocks: ideally at NEXT, just
+   past the last block allocated or skipped over.  If RESERVED is
+   nonzero, the RESERVED sectors starting at NEXT have already
+   been allocated for the file, and new blocks are taken from
+   them in order. */
+struct alloc_goal
+  {
+    block_sector_t next;                /* Ideal sector for next block. */
+    size_t reserved;                    /* Sectors from NEXT on already ours. */
+  };
+
 /* note we have to update length info after call allocate function */
-bool inode_allocate (struct inode_disk *, off_t);
-bool inode_allocate_direct (struct inode_disk *, off_t);
-bool inode_allocate_indirect (struct inode_disk *, off_t);
-bool inode_allocate_indirect_double (struct inode_disk *, off_t);
+/* OWNER is the sector of the inode being grown, so that the
+   blocks written can later be found by inode_flush(). */
+bool inode_allocate (struct inode_disk *, off_t, block_sector_t owner);
+bool inode_allocate_direct (struct inode_disk *, off_t, block_sector_t owner,
+                            struct alloc_goal *);
+bool inode_allocate_indirect (struct inode_disk *, off_t,
+                              block_sector_t owner, struct alloc_goal *);
+bool inode_allocate_indirect_double (struct inode_disk *, off_t,
+                                     block_sector_t owner,
+                                     struct alloc_goal *);
+static bool allocate_blocks (struct inode_disk *, off_t, block_sector_t owner,
+                             struct alloc_goal *);
 bool inode_deallocate (struct inode *);
+static bool inode_promote (struct inode *);
+static bool is_meta (int type, block_sector_t);
+static off_t write_at (struct inode *, const void *, off_t, off_t);
+static off_t step_size (const struct inode *);
+static bool reserve_blocks (struct inode *, off_t start, off_t length);
+static size_t sectors_missing (const struct inode_disk *, size_t sectors);
+static block_sector_t fill_hole (struct inode *, size_t block_idx);
+static void punch_block (struct inode_disk *, block_sector_t owner,
+                         size_t block_idx);
+static void zero_bytes (struct inode *, off_t offset, int size);
+static bool index_empty (const struct indirect_inode_disk *);
+static void free_blocks_from (struct inode_disk *, block_sector_t owner,
+                              size_t first);
 
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache for struct inode, which is a little over a sector in
+   size and so would waste nearly half of a 1 kB malloc block. */
+static struct kmem_cache *inode_cache;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -134,6 +208,8 @@ inode_create (block_sector_t sector, off_t length, int type)
   bool success = false;
 
   ASSERT (length >= 0);
+  if (length > INODE_MAX_LENGTH)
+    return false;
 
   // printf ("sector %d of length %d is created\n", sector, length);
 
@@ -155,6 +231,17 @@ inode_create (block_sector_t sector, off_t length, int type)
         }
       disk_inode->indirect_pointer = 0;
       disk_inode->double_indirect_pointer = 0;
+
+      /* Small files and directories live in the inode sector
+         until they outgrow it. */
+      if (length <= INODE_INLINE_SIZE)
+        {
+          disk_inode->flags = INODE_INLINE;
+          buffer_cache_write_meta (fs_device, sector, disk_inode, sector);
+          free (disk_inode);
+          return true;
+        }
+
       // if (free_map_allocate (sectors, &disk_inode->direct_blocks[0])) 
       //   {
       //     buffer_cache_write (fs_device, sector, disk_inode);
@@ -169,9 +256,12 @@ inode_create (block_sector_t sector, off_t length, int type)
       //     success = true; 
       //   } 
       /* i decide to use sparse file system. */
-      if (inode_allocate(disk_inode, length))
+      /* A file's blocks are allocated as they are written.
+         Directories and the free map get theirs up front. */
+      if (!is_meta (type, sector)
+          || inode_allocate (disk_inode, length, sector))
         {
-          buffer_cache_write (fs_device, sector, disk_inode);
+          buffer_cache_write_meta (fs_device, sector, disk_inode, sector);
           success = true; 
           // printf ("Cool\n");
         }
@@ -203,7 +293,7 @@ inode_open (block_sector_t sector)
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
@@ -213,7 +303,7 @@ inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  buffer_cache_read (fs_device, inode->sector, &inode->data);
+  buffer_cache_read_meta (fs_device, inode->sector, &inode->data);
   
   return inode;
 }
@@ -252,17 +342,20 @@ inode_close (struct inode *inode)
 
       // printf ("the length of inode is %d\n", inode_length (inode));
  
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks if removed, in one transaction with the
+         inode sector itself.  The cached copy of the inode sector
+         is dropped so that it cannot be written over the sector's
+         next use. */
       if (inode->removed) 
         {
-          PANIC ("REACH HERE\n");
-          free_map_release (inode->sector, 1);
-          // free_map_release (inode->data.direct_blocks[0],
-          //                   bytes_to_sectors (inode->data.length));
+          journal_begin ();
           inode_deallocate (inode);
+          buffer_cache_discard (inode->sector);
+          free_map_release (inode->sector, 1);
+          journal_end ();
         }
 
-      free (inode); 
+      kmem_cache_free (inode_cache, inode); 
     }
 }
 
@@ -275,6 +368,45 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if the contents of the inode in sector SECTOR,
+   whose type is TYPE, are metadata: a directory or the free
+   map. */
+static bool
+is_meta (int type, block_sector_t sector)
+{
+  return type == DIR || sector == FREE_MAP_SECTOR;
+}
+
+/* Writes BUFFER to block BLOCK_IDX of INODE, stored in SECTOR.
+   Metadata contents are cached in the buffer cache, which
+   journals them, and file data in the page cache. */
+static void
+cache_write (const struct inode *inode, size_t block_idx,
+             block_sector_t sector, const void *buffer)
+{
+  if (is_meta (inode->data.inode_type, inode->sector))
+    buffer_cache_write_meta (fs_device, sector, buffer, inode->sector);
+  else
+    page_cache_write (inode->sector, block_idx, sector, buffer, 0,
+                      BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the sector of block BLOCK_IDX of INODE_, or -1 if it is
+   past the end of the file or a hole.  Lets the page cache read
+   the rest of a page on a miss. */
+static block_sector_t
+map_block (void *inode_, size_t block_idx)
+{
+  struct inode *inode = inode_;
+  off_t pos = block_idx * BLOCK_SECTOR_SIZE;
+  block_sector_t sector;
+
+  if (pos >= inode->data.length)
+    return -1;
+  sector = byte_to_sector (inode, pos);
+  return sector != HOLE ? sector : (block_sector_t) -1;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, direct_blocks[0]ing at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -285,6 +417,16 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
 
+  if (inode->data.flags & INODE_INLINE)
+    {
+      if (offset >= inode->data.length)
+        return 0;
+      if (size > inode->data.length - offset)
+        size = inode->data.length - offset;
+      memcpy (buffer, inode->data.inline_data + offset, size);
+      return size;
+    }
+
   while (size > 0) 
     {
       /* Disk sector to read, direct_blocks[0]ing byte offset within sector. */
@@ -298,13 +440,26 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
       /* Number of bytes to actually copy out of this sector. */
       int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      if (chunk_size <= 0 || sector_idx == (block_sector_t) -1)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == HOLE)
+        {
+          /* Holes read as zeros, without I/O. */
+          memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (!is_meta (inode->data.inode_type, inode->sector))
+        {
+          /* File data comes from the page cache, which copies
+             partial blocks itself. */
+          page_cache_read (inode->sector, offset / BLOCK_SECTOR_SIZE,
+                           sector_idx, buffer + bytes_read, sector_ofs,
+                           chunk_size, map_block, inode);
+        }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
           /* Read full sector directly into caller's buffer. */
-          buffer_cache_read (fs_device, sector_idx, buffer + bytes_read);
+          buffer_cache_read_meta (fs_device, sector_idx, buffer + bytes_read);
         }
       else 
         {
@@ -316,7 +471,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
               if (bounce == NULL)
                 break;
             }
-          buffer_cache_read (fs_device, sector_idx, bounce);
+          buffer_cache_read_meta (fs_device, sector_idx, bounce);
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
       
@@ -338,29 +493,102 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t step = step_size (inode);
+  off_t bytes_written = 0;
+  bool reclaimed = false;
+
+  /* Growth and directory updates are journaled together.  A big
+     write goes in steps that each end on a multiple of STEP, so
+     that none outgrows its transaction; each leaves the file
+     consistent, with at worst a shorter length. */
+  do
+    {
+      off_t pos = offset + bytes_written;
+      off_t chunk = step - pos % step;
+      off_t written;
+
+      if (chunk > size - bytes_written)
+        chunk = size - bytes_written;
+      journal_begin ();
+      written = write_at (inode, buffer + bytes_written, chunk, pos);
+      journal_end ();
+      bytes_written += written;
+
+      /* The disk may only look full because freed sectors are
+         waiting for the log to start over.  If so, make them
+         available and try once more. */
+      if (written < chunk && (reclaimed || !free_map_reclaim ()))
+        break;
+      if (written < chunk)
+        reclaimed = true;
+    }
+  while (bytes_written < size);
+  return bytes_written;
+}
+
+/* Returns the number of bytes of INODE that one journaled step
+   may cover. */
+static off_t
+step_size (const struct inode *inode)
+{
+  return ((is_meta (inode->data.inode_type, inode->sector)
+           ? META_STEP_BLOCKS : STEP_BLOCKS) * BLOCK_SECTOR_SIZE);
+}
+
+/* Does the work of inode_write_at(). */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+          off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
   uint8_t *bounce = NULL;
+  bool changed = false;
+  off_t old_length;
+
+  if (offset >= INODE_MAX_LENGTH)
+    return 0;
+  if (size > INODE_MAX_LENGTH - offset)
+    size = INODE_MAX_LENGTH - offset;
 
-  if (byte_to_sector (inode, size+offset) == -1)
+  if (inode->data.flags & INODE_INLINE)
     {
-      // printf ("current size is %d:realloc size is %d\n",inode->data.length, offset+size);
-      inode->data.length = size + offset;
-      buffer_cache_write (fs_device, inode->sector, &inode->data);
-      if (!inode_allocate(&inode->data, size+offset))
+      if (inode->deny_write_cnt)
+        return 0;
+      if (offset + size <= INODE_INLINE_SIZE)
         {
-          PANIC ("Realloc failed\n");
+          /* Zero any gap between the old end of file and
+             OFFSET. */
+          if (offset > inode->data.length)
+            memset (inode->data.inline_data + inode->data.length, 0,
+                    offset - inode->data.length);
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (offset + size > inode->data.length)
+            inode->data.length = offset + size;
+          buffer_cache_write_meta (fs_device, inode->sector, &inode->data,
+                                    inode->sector);
+          return size;
         }
-      inode->data.length = size + offset;
-      // printf ("sector is %d\n", inode->sector);
-      buffer_cache_write (fs_device, inode->sector, &inode->data);
-      // printf ("the length of the sector is %d", inode_length (inode));
+      if (!inode_promote (inode))
+        return 0;
     }
 
   if (inode->deny_write_cnt)
     return 0;
 
+  /* Growing only moves the end of file; the blocks in between
+     stay holes unless they are written.  If the write falls
+     short, the end of file moves back below. */
+  old_length = inode->data.length;
+  if (offset + size > inode->data.length)
+    {
+      // printf ("current size is %d:realloc size is %d\n",inode->data.length, offset+size);
+      inode->data.length = offset + size;
+      changed = true;
+    }
+
   while (size > 0) 
     {
       /* Sector to write, direct_blocks[0]ing byte offset within sector. */
@@ -377,10 +605,27 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == HOLE)
+        {
+          sector_idx = fill_hole (inode, offset / BLOCK_SECTOR_SIZE);
+          changed = true;
+          if (sector_idx == HOLE)
+            break;
+        }
+
+      if (!is_meta (inode->data.inode_type, inode->sector))
+        {
+          /* File data goes to the page cache, which reads in a
+             partially written block itself if it has to. */
+          page_cache_write (inode->sector, offset / BLOCK_SECTOR_SIZE,
+                            sector_idx, buffer + bytes_written, sector_ofs,
+                            chunk_size);
+        }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
           /* Write full sector directly to disk. */
-          buffer_cache_write (fs_device, sector_idx, buffer + bytes_written);
+          buffer_cache_write_meta (fs_device, sector_idx,
+                                   buffer + bytes_written, inode->sector);
         }
       else 
         {
@@ -396,11 +641,12 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
              we're writing, then we need to read in the sector
              first.  Otherwise we direct_blocks[0] with a sector of all zeros. */
           if (sector_ofs > 0 || chunk_size < sector_left) 
-            buffer_cache_read (fs_device, sector_idx, bounce);
+            buffer_cache_read_meta (fs_device, sector_idx, bounce);
           else
             memset (bounce, 0, BLOCK_SECTOR_SIZE);
           memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          buffer_cache_write (fs_device, sector_idx, bounce);
+          buffer_cache_write_meta (fs_device, sector_idx, bounce,
+                                   inode->sector);
         }
 
       /* Advance. */
@@ -409,10 +655,214 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       bytes_written += chunk_size;
     }
   free (bounce);
+  if (inode->data.length > old_length
+      && inode->data.length > offset + bytes_written)
+    inode->data.length = (offset + bytes_written > old_length
+                          ? offset + bytes_written : old_length);
+  if (changed)
+    buffer_cache_write_meta (fs_device, inode->sector, &inode->data,
+                              inode->sector);
 
   return bytes_written;
 }
 
+/* Allocates every block of the first LENGTH bytes of INODE, in
+   as few runs of contiguous sectors as possible, and extends
+   INODE to LENGTH bytes if it is shorter.  Returns true if
+   successful.  Fails without allocating anything if the file
+   would be too big or the disk is too full, but if the disk
+   fills up meanwhile, may have allocated some blocks. */
+bool
+inode_reserve (struct inode *inode, off_t length)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  off_t step = STEP_BLOCKS * BLOCK_SECTOR_SIZE;
+  bool success = true;
+  off_t start;
+
+  if (inode->deny_write_cnt)
+    return false;
+
+  if (disk_inode->flags & INODE_INLINE)
+    {
+      journal_begin ();
+      if (length > INODE_INLINE_SIZE)
+        success = inode_promote (inode);
+      else if (length > disk_inode->length)
+        {
+          memset (disk_inode->inline_data + disk_inode->length, 0,
+                  length - disk_inode->length);
+          disk_inode->length = length;
+          buffer_cache_write_meta (fs_device, inode->sector, disk_inode,
+                                    inode->sector);
+        }
+      journal_end ();
+      if (!success || (disk_inode->flags & INODE_INLINE))
+        return success;
+    }
+
+  if (bytes_to_sectors (length) >= LAYER_2)
+    return false;
+  if (sectors_missing (disk_inode, bytes_to_sectors (length))
+      > free_map_free_cnt ()
+      && (!free_map_reclaim ()
+          || sectors_missing (disk_inode, bytes_to_sectors (length))
+             > free_map_free_cnt ()))
+    return false;
+
+  /* One step, and one transaction, at a time. */
+  for (start = 0; success && start < length; start += step)
+    {
+      journal_begin ();
+      success = reserve_blocks (inode, start,
+                                length - start < step ? length : start + step);
+      journal_end ();
+    }
+  return success;
+}
+
+/* Zeroes SIZE bytes of regular file INODE starting at OFFSET,
+   which must all be in one block, unless that block is a
+   hole. */
+static void
+zero_bytes (struct inode *inode, off_t offset, int size)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector = byte_to_sector (inode, offset);
+
+  ASSERT (offset % BLOCK_SECTOR_SIZE + size <= BLOCK_SECTOR_SIZE);
+  if (sector != HOLE)
+    page_cache_write (inode->sector, offset / BLOCK_SECTOR_SIZE, sector,
+                      zeros, offset % BLOCK_SECTOR_SIZE, size);
+}
+
+/* Turns the SIZE bytes of INODE, which must not be a directory,
+   starting at OFFSET into a hole: frees the blocks that lie
+   wholly within them, along with any index blocks left empty,
+   and zeroes the rest.  The length of INODE does not change.
+   Returns true if successful. */
+bool
+inode_punch (struct inode *inode, off_t offset, off_t size)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  off_t end;
+
+  ASSERT (!inode_is_dir (inode));
+  ASSERT (offset >= 0 && size >= 0);
+  if (inode->deny_write_cnt)
+    return false;
+  if (offset >= disk_inode->length)
+    return true;
+  end = size < disk_inode->length - offset ? offset + size
+                                           : disk_inode->length;
+
+  if (disk_inode->flags & INODE_INLINE)
+    {
+      journal_begin ();
+      memset (disk_inode->inline_data + offset, 0, end - offset);
+      buffer_cache_write_meta (fs_device, inode->sector, disk_inode,
+                                inode->sector);
+      journal_end ();
+    }
+  else
+    {
+      /* Blocks FIRST up to LAST lie wholly within the range,
+         counting a last block that it covers up to the end of
+         file. */
+      size_t first = DIV_ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+      size_t last = (end == disk_inode->length
+                     ? DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE)
+                     : end / BLOCK_SECTOR_SIZE);
+      size_t i, step_end;
+
+      if (first > last)
+        zero_bytes (inode, offset, end - offset);
+      else
+        {
+          if (offset < (off_t) (first * BLOCK_SECTOR_SIZE))
+            zero_bytes (inode, offset, first * BLOCK_SECTOR_SIZE - offset);
+          if ((off_t) (last * BLOCK_SECTOR_SIZE) < end)
+            zero_bytes (inode, last * BLOCK_SECTOR_SIZE,
+                        end - last * BLOCK_SECTOR_SIZE);
+        }
+
+      /* Free the blocks one step, and one transaction, at a
+         time. */
+      for (i = first; i < last; i = step_end)
+        {
+          step_end = (i / STEP_BLOCKS + 1) * STEP_BLOCKS;
+          if (step_end > last)
+            step_end = last;
+          journal_begin ();
+          page_cache_discard_blocks (inode->sector, i, step_end - i);
+          for (; i < step_end; i++)
+            punch_block (disk_inode, inode->sector, i);
+          buffer_cache_write_meta (fs_device, inode->sector, disk_inode,
+                                    inode->sector);
+          journal_end ();
+        }
+    }
+  return true;
+}
+
+/* Sets the length of INODE, which must not be a directory, to
+   LENGTH bytes.  Growing it leaves a hole at the end; shrinking
+   it frees the blocks past the new end.  Returns true if
+   successful, false if LENGTH is over INODE_MAX_LENGTH. */
+bool
+inode_truncate (struct inode *inode, off_t length)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  bool success = true;
+
+  ASSERT (!inode_is_dir (inode));
+  if (inode->deny_write_cnt || length > INODE_MAX_LENGTH)
+    return false;
+
+  journal_begin ();
+  if (disk_inode->flags & INODE_INLINE && length <= INODE_INLINE_SIZE)
+    {
+      if (length > disk_inode->length)
+        memset (disk_inode->inline_data + disk_inode->length, 0,
+                length - disk_inode->length);
+      else
+        memset (disk_inode->inline_data + length, 0,
+                disk_inode->length - length);
+      disk_inode->length = length;
+      buffer_cache_write_meta (fs_device, inode->sector, disk_inode,
+                                inode->sector);
+    }
+  else if (length >= disk_inode->length)
+    {
+      if (disk_inode->flags & INODE_INLINE)
+        success = inode_promote (inode);
+      if (success)
+        {
+          disk_inode->length = length;
+          buffer_cache_write_meta (fs_device, inode->sector, disk_inode,
+                                    inode->sector);
+        }
+    }
+  else
+    {
+      size_t first = bytes_to_sectors (length);
+      int ofs = length % BLOCK_SECTOR_SIZE;
+
+      page_cache_discard_blocks (inode->sector, first, SIZE_MAX);
+      free_blocks_from (disk_inode, inode->sector, first);
+
+      /* Zero the rest of the new last block, so that growing the
+         file again exposes zeros. */
+      if (ofs != 0)
+        zero_bytes (inode, length, BLOCK_SECTOR_SIZE - ofs);
+      disk_inode->length = length;
+      buffer_cache_write_meta (fs_device, inode->sector, disk_inode,
+                                inode->sector);
+    }
+  journal_end ();
+  return success;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -441,7 +891,21 @@ inode_length (const struct inode *inode)
 }
 
 bool
-inode_allocate (struct inode_disk * disk_inode, off_t length)
+inode_allocate (struct inode_disk * disk_inode, off_t length,
+                block_sector_t owner)
+{
+  struct alloc_goal goal;
+
+  goal.next = owner + 1;
+  goal.reserved = 0;
+  return allocate_blocks (disk_inode, length, owner, &goal);
+}
+
+/* Like inode_allocate(), but puts new blocks according to
+   GOAL. */
+static bool
+allocate_blocks (struct inode_disk *disk_inode, off_t length,
+                 block_sector_t owner, struct alloc_goal *goal)
 {
   size_t sectors = bytes_to_sectors (length);
 
@@ -449,18 +913,21 @@ inode_allocate (struct inode_disk * disk_inode, off_t length)
 
   if (sectors < LAYER_0)
     {
-      return inode_allocate_direct (disk_inode, sectors);
+      return inode_allocate_direct (disk_inode, sectors, owner, goal);
     }
   else if (sectors < LAYER_1)
     {
-      return inode_allocate_direct (disk_inode, LAYER_0) &&\
-             inode_allocate_indirect (disk_inode, sectors-LAYER_0);
+      return inode_allocate_direct (disk_inode, LAYER_0, owner, goal) &&\
+             inode_allocate_indirect (disk_inode, sectors-LAYER_0, owner,
+                                      goal);
     }
   else if (sectors < LAYER_2)
     {
-      return inode_allocate_direct (disk_inode, LAYER_0) &&\
-             inode_allocate_indirect (disk_inode, LAYER_1 - LAYER_0) &&\
-             inode_allocate_indirect_double (disk_inode, sectors-LAYER_1);
+      return inode_allocate_direct (disk_inode, LAYER_0, owner, goal) &&\
+             inode_allocate_indirect (disk_inode, LAYER_1 - LAYER_0, owner,
+                                      goal) &&\
+             inode_allocate_indirect_double (disk_inode, sectors-LAYER_1, owner,
+                                             goal);
       // return false;
     }
   else
@@ -469,34 +936,74 @@ inode_allocate (struct inode_disk * disk_inode, off_t length)
     }
 }
 
+/* Zero-fills block BLOCK_IDX, newly allocated in SECTOR, of the
+   inode in sector OWNER whose contents are DISK_INODE, in
+   whichever cache holds its data. */
+static void
+zero_block (const struct inode_disk *disk_inode, block_sector_t owner,
+            size_t block_idx, block_sector_t sector)
+{
+  if (is_meta (disk_inode->inode_type, owner))
+    buffer_cache_zero (fs_device, sector, owner);
+  else
+    page_cache_zero (owner, block_idx, sector);
+}
+
+/* Allocates a sector for a new block of a file, as GOAL directs,
+   stores it in *SECTORP, and advances GOAL past it. */
+static bool
+allocate_block (struct alloc_goal *goal, block_sector_t *sectorp)
+{
+  if (goal->reserved > 0)
+    {
+      *sectorp = goal->next++;
+      goal->reserved--;
+      return true;
+    }
+  if (!free_map_allocate_data (goal->next, sectorp))
+    return false;
+  goal->next = *sectorp + 1;
+  return true;
+}
+
+/* Notes that the file's next block is already allocated, in
+   SECTOR, so that unreserved blocks after it go after it. */
+static void
+skip_block (struct alloc_goal *goal, block_sector_t sector)
+{
+  if (goal->reserved == 0)
+    goal->next = sector + 1;
+}
+
 bool
-inode_allocate_direct (struct inode_disk * disk_inode, off_t sectors)
+inode_allocate_direct (struct inode_disk * disk_inode, off_t sectors,
+                       block_sector_t owner, struct alloc_goal *goal)
 {
   // printf ("alloc_1\n");
 
-  static char zeros[BLOCK_SECTOR_SIZE];
   for (size_t i = 0; i < sectors; i++)
     {
       if (disk_inode->direct_blocks[i] != 0)
         {
+          skip_block (goal, disk_inode->direct_blocks[i]);
           continue;
         }
 
-      if (!free_map_allocate (1, &disk_inode->direct_blocks[i]))
+      if (!allocate_block (goal, &disk_inode->direct_blocks[i]))
         {
           return false;
         }
-      buffer_cache_write (fs_device, disk_inode->direct_blocks[i], zeros);
+      zero_block (disk_inode, owner, i, disk_inode->direct_blocks[i]);
     }
   return true;
 }
 
 bool
-inode_allocate_indirect (struct inode_disk *disk_inode, off_t sectors)
+inode_allocate_indirect (struct inode_disk *disk_inode, off_t sectors,
+                         block_sector_t owner, struct alloc_goal *goal)
 {
   // printf ("sectors is %d\n");
   // printf ("alloc_2\n");
-  static char zeros[BLOCK_SECTOR_SIZE] = {0};
   // if (!free_map_allocate (1, &disk_inode->indirect_pointer))
   //   {
   //     PANIC ("inode_allocate_indirect failed\n");
@@ -506,17 +1013,17 @@ inode_allocate_indirect (struct inode_disk *disk_inode, off_t sectors)
   bool success;
   if (disk_inode->indirect_pointer == 0)
     {
-      success = free_map_allocate (1, &disk_inode->indirect_pointer);
+      success = allocate_block (goal, &disk_inode->indirect_pointer);
       if (!success)
         {
           PANIC ("inode_allocate_indirect failed\n");
           return success;
         }
-      buffer_cache_write (fs_device, disk_inode->indirect_pointer, zeros);
+      buffer_cache_zero (fs_device, disk_inode->indirect_pointer, owner);
     }
   
   struct indirect_inode_disk iid;
-  buffer_cache_read (fs_device, disk_inode->indirect_pointer, &iid);
+  buffer_cache_read_meta (fs_device, disk_inode->indirect_pointer, &iid);
 
 
 
@@ -531,29 +1038,31 @@ inode_allocate_indirect (struct inode_disk *disk_inode, off_t sectors)
       /* realloc */
       if (iid.blocks[i] != 0)
         {
+          skip_block (goal, iid.blocks[i]);
           continue;
         }
       /* realloc */
-      if (!free_map_allocate (1, &iid.blocks[i]))
+      if (!allocate_block (goal, &iid.blocks[i]))
         {
           return false;
         }
-      buffer_cache_write (fs_device, iid.blocks[i], zeros);
+      zero_block (disk_inode, owner, LAYER_0 + i, iid.blocks[i]);
     }
   for (size_t i = 0; i < sectors; i++)
     {
       // printf ("%d is initialized\n", iid.blocks[i]);
     }
-  buffer_cache_write (fs_device, disk_inode->indirect_pointer, &iid);
+  buffer_cache_write_meta (fs_device, disk_inode->indirect_pointer, &iid,
+                            owner);
 
   return true;
 }
 
 bool
-inode_allocate_indirect_double (struct inode_disk * disk_inode, off_t sectors)
+inode_allocate_indirect_double (struct inode_disk * disk_inode, off_t sectors,
+                                block_sector_t owner, struct alloc_goal *goal)
 {
   // printf ("alloc_3\n");
-  static char zeros[BLOCK_SECTOR_SIZE];
   bool success;
   // if (!free_map_allocate (1, &disk_inode->double_indirect_pointer))
   //   {
@@ -566,18 +1075,18 @@ inode_allocate_indirect_double (struct inode_disk * disk_inode, off_t sectors)
   if (disk_inode->double_indirect_pointer == 0)
     {
       // printf ("reach here when init\n");
-      success = free_map_allocate (1, &disk_inode->double_indirect_pointer);
+      success = allocate_block (goal, &disk_inode->double_indirect_pointer);
       if (!success)
         {
           PANIC ("inode_allocate_double_indirect failed\n");
           return success;
         }
-      buffer_cache_write (fs_device, disk_inode->double_indirect_pointer, zeros);
+      buffer_cache_zero (fs_device, disk_inode->double_indirect_pointer, owner);
     }
   /* realloc */
 
   struct indirect_inode_disk double_iid;
-  buffer_cache_read (fs_device, disk_inode->double_indirect_pointer, &double_iid);
+  buffer_cache_read_meta (fs_device, disk_inode->double_indirect_pointer, &double_iid);
   int index = 0;
 
   while (sectors > 0)
@@ -589,16 +1098,16 @@ inode_allocate_indirect_double (struct inode_disk * disk_inode, off_t sectors)
       //   }
       if (double_iid.blocks[index] == 0)
         {
-          success = free_map_allocate (1, &double_iid.blocks[index]);
+          success = allocate_block (goal, &double_iid.blocks[index]);
           if (!success)
             {
               PANIC ("inode_allocate_double_indirect failed\n");
               return success;
             }
-          buffer_cache_write (fs_device, double_iid.blocks[index], zeros);
+          buffer_cache_zero (fs_device, double_iid.blocks[index], owner);
         }
       struct indirect_inode_disk iid;
-      buffer_cache_read (fs_device, double_iid.blocks[index], &iid);
+      buffer_cache_read_meta (fs_device, double_iid.blocks[index], &iid);
 
       // printf ("allocate is %d\n", allocate_size);
 
@@ -607,21 +1116,25 @@ inode_allocate_indirect_double (struct inode_disk * disk_inode, off_t sectors)
           /* realloc */
           if (iid.blocks[i] != 0)
           {
+            skip_block (goal, iid.blocks[i]);
             continue;
           }
           /* realloc */
-          if (!free_map_allocate (1, &iid.blocks[i]))
+          if (!allocate_block (goal, &iid.blocks[i]))
             {
               return false;
             }
-          buffer_cache_write (fs_device, iid.blocks[i], zeros);
+          zero_block (disk_inode, owner,
+                      LAYER_1 + index * INDIRECT_BN + i, iid.blocks[i]);
         }
-      buffer_cache_write (fs_device, double_iid.blocks[index], &iid);
+      buffer_cache_write_meta (fs_device, double_iid.blocks[index], &iid,
+                                owner);
 
       sectors -= allocate_size;
       index++;
     }
-  buffer_cache_write (fs_device, disk_inode->double_indirect_pointer, &double_iid);
+  buffer_cache_write_meta (fs_device, disk_inode->double_indirect_pointer, &double_iid,
+                            owner);
 
   // struct indirect_inode_disk iid;
 
@@ -642,80 +1155,405 @@ inode_allocate_indirect_double (struct inode_disk * disk_inode, off_t sectors)
   return true;
 }
 
-bool
-inode_deallocate (struct inode *inode)
+/* Moves the data of inline INODE out of its inode sector into a
+   newly allocated first data block, so that it can grow beyond
+   INODE_INLINE_SIZE bytes.  Returns true if successful. */
+static bool
+inode_promote (struct inode *inode)
 {
-  if (inode->data.length < 0)
+  struct inode_disk *disk_inode = &inode->data;
+  uint8_t *bounce;
+
+  ASSERT (disk_inode->flags & INODE_INLINE);
+
+  bounce = calloc (1, BLOCK_SECTOR_SIZE);
+  if (bounce == NULL)
+    return false;
+  memcpy (bounce, disk_inode->inline_data, disk_inode->length);
+
+  struct alloc_goal goal;
+
+  goal.next = inode->sector + 1;
+  goal.reserved = 0;
+  if (!inode_allocate_direct (disk_inode, 1, inode->sector, &goal))
     {
+      free (bounce);
       return false;
     }
-  int sectors = bytes_to_sectors (inode->data.length);
-  if (sectors <= LAYER_0)
+  cache_write (inode, 0, disk_inode->direct_blocks[0], bounce);
+  free (bounce);
+
+  disk_inode->flags &= ~INODE_INLINE;
+  memset (disk_inode->inline_data, 0, sizeof disk_inode->inline_data);
+  buffer_cache_write_meta (fs_device, inode->sector, disk_inode,
+                            inode->sector);
+  return true;
+}
+
+/* Returns the number of sectors, for data and index blocks, that
+   allocate_blocks() would take to give DISK_INODE its first
+   SECTORS blocks. */
+static size_t
+sectors_missing (const struct inode_disk *disk_inode, size_t sectors)
+{
+  struct indirect_inode_disk iid;
+  size_t cnt = 0;
+  size_t i, j;
+
+  for (i = 0; i < sectors && i < LAYER_0; i++)
+    cnt += disk_inode->direct_blocks[i] == 0;
+
+  if (sectors >= LAYER_0)
     {
-      for (int i = 0; i < sectors; i++)
+      size_t n = (sectors < LAYER_1 ? sectors : LAYER_1) - LAYER_0;
+      if (disk_inode->indirect_pointer == 0)
+        cnt += 1 + n;
+      else
         {
-          free_map_release (inode->data.direct_blocks[i], 1);
+          buffer_cache_read_meta (fs_device, disk_inode->indirect_pointer, &iid);
+          for (i = 0; i < n; i++)
+            cnt += iid.blocks[i] == 0;
         }
     }
-  else if (sectors <= LAYER_1)
+
+  if (sectors >= LAYER_1)
     {
-      for (int i = 0; i < LAYER_0; i++)
+      struct indirect_inode_disk double_iid;
+      size_t n = sectors - LAYER_1;
+
+      if (disk_inode->double_indirect_pointer == 0)
+        return cnt + 1 + n + DIV_ROUND_UP (n, INDIRECT_BN);
+      buffer_cache_read_meta (fs_device, disk_inode->double_indirect_pointer,
+                              &double_iid);
+      for (j = 0; j * INDIRECT_BN < n; j++)
         {
-          free_map_release (inode->data.direct_blocks[i], 1);
+          size_t m = n - j * INDIRECT_BN;
+          if (m > INDIRECT_BN)
+            m = INDIRECT_BN;
+          if (double_iid.blocks[j] == 0)
+            cnt += 1 + m;
+          else
+            {
+              buffer_cache_read_meta (fs_device, double_iid.blocks[j], &iid);
+              for (i = 0; i < m; i++)
+                cnt += iid.blocks[i] == 0;
+            }
         }
-      
-      struct indirect_inode_disk iid;
-      buffer_cache_read (fs_device, inode->data.indirect_pointer, &iid);
-      for (int i = 0; i < sectors-LAYER_1; i++)
+    }
+  return cnt;
+}
+
+/* Allocates the blocks INODE, which is not inline, lacks for its
+   first LENGTH bytes, and extends it to LENGTH bytes if it is
+   shorter, writing its inode sector once at the end.  It must
+   already have every block before byte START.  Tries first to
+   allocate all of the new blocks as one run of sectors, right
+   after the block before START.  Returns true if successful,
+   false without allocating anything if the file would be too
+   big or the disk is too full. */
+static bool
+reserve_blocks (struct inode *inode, off_t start, off_t length)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  size_t sectors = bytes_to_sectors (length);
+  struct alloc_goal goal;
+  size_t cnt;
+  bool success;
+
+  ASSERT (!(disk_inode->flags & INODE_INLINE));
+
+  if (sectors >= LAYER_2)
+    return false;
+  cnt = sectors_missing (disk_inode, sectors);
+  if (cnt > free_map_free_cnt ())
+    return false;
+
+  goal.next = inode->sector + 1;
+  if (start > 0)
+    goal.next = byte_to_sector (inode, start - 1) + 1;
+  goal.reserved = 0;
+  if (cnt > 0 && free_map_allocate_near (cnt, goal.next, &goal.next))
+    goal.reserved = cnt;
+
+  success = allocate_blocks (disk_inode, length, inode->sector, &goal);
+  if (goal.reserved > 0)
+    free_map_release (goal.next, goal.reserved);
+  if (success && length > disk_inode->length)
+    disk_inode->length = length;
+  buffer_cache_write_meta (fs_device, inode->sector, disk_inode,
+                            inode->sector);
+  return success;
+}
+
+/* Frees the sector in *SECTORP, if any, and clears *SECTORP. */
+static void
+release_block (block_sector_t *sectorp)
+{
+  if (*sectorp == 0)
+    return;
+  buffer_cache_discard (*sectorp);
+  free_map_release (*sectorp, 1);
+  *sectorp = 0;
+}
+
+/* Frees the blocks that index block SECTOR, of the inode in sector
+   OWNER, points to from entry FIRST on.  Returns true if SECTOR
+   then points to nothing, as when FIRST is 0 or the entries before
+   FIRST are all holes, in which case the caller should free SECTOR
+   itself. */
+static bool
+free_index_from (block_sector_t sector, block_sector_t owner, size_t first)
+{
+  struct indirect_inode_disk iid;
+  bool changed = false;
+  size_t i;
+
+  buffer_cache_read_meta (fs_device, sector, &iid);
+  for (i = first; i < INDIRECT_BN; i++)
+    if (iid.blocks[i] != 0)
+      {
+        release_block (&iid.blocks[i]);
+        changed = true;
+      }
+  if (index_empty (&iid))
+    return true;
+  if (changed)
+    buffer_cache_write_meta (fs_device, sector, &iid, owner);
+  return false;
+}
+
+/* Frees block FIRST and every later block of DISK_INODE, whose
+   sector is OWNER, along with the index blocks that no longer
+   point to anything, and clears the pointers to them.  The caller
+   writes DISK_INODE back. */
+static void
+free_blocks_from (struct inode_disk *disk_inode, block_sector_t owner,
+                  size_t first)
+{
+  size_t i;
+
+  for (i = first; i < LAYER_0; i++)
+    release_block (&disk_inode->direct_blocks[i]);
+
+  if (disk_inode->indirect_pointer != 0
+      && free_index_from (disk_inode->indirect_pointer, owner,
+                          first > LAYER_0 ? first - LAYER_0 : 0))
+    release_block (&disk_inode->indirect_pointer);
+
+  if (disk_inode->double_indirect_pointer != 0)
+    {
+      struct indirect_inode_disk double_iid;
+      size_t start = first > LAYER_1 ? first - LAYER_1 : 0;
+      bool changed = false;
+
+      buffer_cache_read_meta (fs_device, disk_inode->double_indirect_pointer,
+                              &double_iid);
+      for (i = start / INDIRECT_BN; i < INDIRECT_BN; i++)
         {
-          free_map_release (iid.blocks[i], 1);
+          size_t from = i == start / INDIRECT_BN ? start % INDIRECT_BN : 0;
+          if (double_iid.blocks[i] != 0
+              && free_index_from (double_iid.blocks[i], owner, from))
+            {
+              release_block (&double_iid.blocks[i]);
+              changed = true;
+            }
         }
-      free_map_release (inode->data.direct_blocks, 1);
-      
+      if (index_empty (&double_iid))
+        release_block (&disk_inode->double_indirect_pointer);
+      else if (changed)
+        buffer_cache_write_meta (fs_device,
+                                 disk_inode->double_indirect_pointer,
+                                 &double_iid, owner);
+    }
+}
+
+/* Allocates the index block that *SECTORP should point to, if it
+   is a hole, as GOAL directs, for the inode in sector OWNER.
+   Returns false if the disk is full. */
+static bool
+fill_index_hole (struct alloc_goal *goal, block_sector_t *sectorp,
+                 block_sector_t owner)
+{
+  if (*sectorp != HOLE)
+    return true;
+  if (!allocate_block (goal, sectorp))
+    return false;
+  buffer_cache_zero (fs_device, *sectorp, owner);
+  return true;
+}
 
+/* Allocates block BLOCK_IDX of INODE, which is a hole, and the
+   index blocks that lead to it, and zero-fills it.  The block
+   goes right after the block before it, if there is one, or else
+   after the inode.  The caller writes the inode sector back.
+   Returns the new block's sector, or HOLE if the disk is full or
+   the file cannot be that long. */
+static block_sector_t
+fill_hole (struct inode *inode, size_t block_idx)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  struct indirect_inode_disk iid;
+  struct alloc_goal goal;
+  block_sector_t prev = HOLE;
+  block_sector_t index_sector;
+  size_t i;
+
+  if (block_idx >= LAYER_2)
+    return HOLE;
+  if (block_idx > 0)
+    prev = byte_to_sector (inode, (block_idx - 1) * BLOCK_SECTOR_SIZE);
+  goal.next = prev != HOLE ? prev + 1 : inode->sector + 1;
+  goal.reserved = 0;
+
+  if (block_idx < LAYER_0)
+    {
+      if (!allocate_block (&goal, &disk_inode->direct_blocks[block_idx]))
+        return HOLE;
+      zero_block (disk_inode, inode->sector, block_idx,
+                  disk_inode->direct_blocks[block_idx]);
+      return disk_inode->direct_blocks[block_idx];
     }
-  else if (sectors <= LAYER_2)
+
+  if (block_idx < LAYER_1)
     {
-      for (int i = 0; i < LAYER_0; i++)
-        {
-          free_map_release (inode->data.direct_blocks[i], 1);
-        }
-      
-      struct indirect_inode_disk iid;
-      buffer_cache_read (fs_device, inode->data.indirect_pointer, &iid);
-      for (int i = 0; i < sectors-LAYER_1; i++)
+      if (!fill_index_hole (&goal, &disk_inode->indirect_pointer,
+                            inode->sector))
+        return HOLE;
+      index_sector = disk_inode->indirect_pointer;
+      i = block_idx - LAYER_0;
+    }
+  else
+    {
+      struct indirect_inode_disk double_iid;
+      size_t j = (block_idx - LAYER_1) / INDIRECT_BN;
+
+      if (!fill_index_hole (&goal, &disk_inode->double_indirect_pointer,
+                            inode->sector))
+        return HOLE;
+      buffer_cache_read_meta (fs_device, disk_inode->double_indirect_pointer,
+                              &double_iid);
+      if (double_iid.blocks[j] == HOLE)
         {
-          free_map_release (iid.blocks[i], 1);
+          if (!fill_index_hole (&goal, &double_iid.blocks[j], inode->sector))
+            return HOLE;
+          buffer_cache_write_meta (fs_device,
+                                   disk_inode->double_indirect_pointer,
+                                   &double_iid, inode->sector);
         }
-      free_map_release (inode->data.direct_blocks, 1);
+      index_sector = double_iid.blocks[j];
+      i = (block_idx - LAYER_1) % INDIRECT_BN;
+    }
+
+  buffer_cache_read_meta (fs_device, index_sector, &iid);
+  if (!allocate_block (&goal, &iid.blocks[i]))
+    return HOLE;
+  zero_block (disk_inode, inode->sector, block_idx, iid.blocks[i]);
+  buffer_cache_write_meta (fs_device, index_sector, &iid, inode->sector);
+  return iid.blocks[i];
+}
 
+/* Returns true if index block IID points to nothing. */
+static bool
+index_empty (const struct indirect_inode_disk *iid)
+{
+  size_t i;
+
+  for (i = 0; i < INDIRECT_BN; i++)
+    if (iid->blocks[i] != HOLE)
+      return false;
+  return true;
+}
+
+/* Frees the block that entry I of index block SECTOR, of the inode
+   in sector OWNER, points to, if any.  Returns true if the index
+   block then points to nothing, in which case the caller should
+   free it. */
+static bool
+punch_index_entry (block_sector_t sector, block_sector_t owner, size_t i)
+{
+  struct indirect_inode_disk iid;
+
+  buffer_cache_read_meta (fs_device, sector, &iid);
+  if (iid.blocks[i] != HOLE)
+    {
+      release_block (&iid.blocks[i]);
+      if (!index_empty (&iid))
+        buffer_cache_write_meta (fs_device, sector, &iid, owner);
+    }
+  return index_empty (&iid);
+}
+
+/* Makes block BLOCK_IDX of DISK_INODE, whose sector is OWNER, a
+   hole, freeing it and any index blocks left pointing to nothing.
+   The caller writes DISK_INODE back. */
+static void
+punch_block (struct inode_disk *disk_inode, block_sector_t owner,
+             size_t block_idx)
+{
+  if (block_idx < LAYER_0)
+    release_block (&disk_inode->direct_blocks[block_idx]);
+  else if (block_idx < LAYER_1)
+    {
+      if (disk_inode->indirect_pointer != HOLE
+          && punch_index_entry (disk_inode->indirect_pointer, owner,
+                                block_idx - LAYER_0))
+        release_block (&disk_inode->indirect_pointer);
+    }
+  else if (disk_inode->double_indirect_pointer != HOLE)
+    {
       struct indirect_inode_disk double_iid;
-      buffer_cache_read (fs_device, inode->data.double_indirect_pointer, &double_iid);
-      int temp = sectors - LAYER_2;
-      int index = 0;
-      while (temp > 0)
-        {
-          int deallocate_size = sectors > INDIRECT_BN? INDIRECT_BN: sectors;
-          buffer_cache_read (fs_device, double_iid.blocks[index], &iid);
-          for (int i = 0;i< deallocate_size; i++)
-            {
-              free_map_release (iid.blocks[i], 1);
-            }
-          free_map_release (double_iid.blocks[index], 1);
-          
-          temp -= deallocate_size;
-          index++;
-        }
-      free_map_release (inode->data.double_indirect_pointer, 1);
+      size_t j = (block_idx - LAYER_1) / INDIRECT_BN;
+
+      buffer_cache_read_meta (fs_device, disk_inode->double_indirect_pointer,
+                              &double_iid);
+      if (double_iid.blocks[j] == HOLE
+          || !punch_index_entry (double_iid.blocks[j], owner,
+                                 (block_idx - LAYER_1) % INDIRECT_BN))
+        return;
+      release_block (&double_iid.blocks[j]);
+      if (index_empty (&double_iid))
+        release_block (&disk_inode->double_indirect_pointer);
+      else
+        buffer_cache_write_meta (fs_device,
+                                 disk_inode->double_indirect_pointer,
+                                 &double_iid, owner);
     }
-  else
+}
+
+bool
+inode_deallocate (struct inode *inode)
+{
+  if (inode->data.length < 0)
     {
-      printf ("Something went wrong\n");
       return false;
     }
+  if (inode->data.flags & INODE_INLINE)
+    {
+      return true;
+    }
+  page_cache_discard_inode (inode->sector);
+  free_blocks_from (&inode->data, inode->sector, 0);
   return true;
 }
 
+/* Writes INODE's dirty data back to disk and makes its index
+   blocks and inode sector durable, along with the free map blocks
+   that record their allocation: by committing them to the
+   journal, if there is one, or else by writing them back.  Other
+   files' dirty blocks stay in the cache. */
+void
+inode_flush (struct inode *inode)
+{
+  page_cache_flush_inode (inode->sector);
+  if (journal_active ())
+    journal_commit ();
+  else
+    {
+      buffer_cache_flush_owner (inode->sector);
+      buffer_cache_flush_owner (FREE_MAP_SECTOR);
+    }
+}
+
 bool
 inode_is_dir (const struct inode *inode)
 {
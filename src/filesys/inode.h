@@ -21,6 +21,10 @@ off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_flush (struct inode *);
+bool inode_reserve (struct inode *, off_t length);
+bool inode_truncate (struct inode *, off_t length);
+bool inode_punch (struct inode *, off_t offset, off_t size);
 // bool inode_allocate (struct inode_disk *);
 
 bool inode_is_dir (const struct inode *);
@@ -0,0 +1,488 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead metadata journal.
+
+   Every metadata block the buffer cache dirties joins the running
+   transaction and may not be written to its home location until
+   the transaction is committed.  A commit appends a descriptor
+   listing the home sectors, a copy of each block, and a commit
+   record carrying a checksum of the lot to the log.  Afterward
+   the blocks are still dirty in the cache and go home whenever
+   the cache gets around to it, so many operations on the same
+   inode or directory cost one log copy per commit.
+
+   Commits happen once a second, from a kernel thread, or sooner
+   when the running transaction reaches JOURNAL_TXN_TARGET blocks
+   or someone asks for durability.  A file system operation runs
+   between journal_begin() and journal_end(), and a commit waits
+   for operations in progress to end and holds off new ones, so
+   each operation lands in one transaction.
+
+   To make sure an operation never outgrows its transaction,
+   journal_begin() reserves room for the most blocks one operation
+   may dirty: JOURNAL_OP_BLOCKS plus the whole free map, which is
+   rewritten on every allocation.  If the running transaction
+   cannot take that many more, it is committed first.  Operations
+   that could dirty more, such as a big write, are split into
+   steps that each leave the file system consistent.  The buffer
+   cache keeps the blocks of the running transaction until it
+   commits rather than evict them.
+
+   When the log has no room left for a full transaction, every
+   dirty metadata block is written home and the log starts over
+   with the next sequence number, which makes the old records
+   stale.  At mount, committed transactions with consecutive
+   sequence numbers starting from the one in the header are
+   replayed in order; the first missing or torn one ends the
+   log.
+
+   File data is not journaled. */
+
+#define JOURNAL_MAGIC 0x4a524e4c        /* Header. */
+#define DESC_MAGIC 0x4a444553           /* Descriptor. */
+#define COMMIT_MAGIC 0x4a434d54         /* Commit record. */
+#define DESC_CNT ((BLOCK_SECTOR_SIZE - 3 * sizeof (unsigned)) \
+                  / sizeof (block_sector_t))
+
+#define JOURNAL_TXN_TARGET 32           /* Commit when this big. */
+#define COMMIT_INTERVAL TIMER_FREQ      /* Ticks between commits. */
+
+/* On-disk journal header, in sector JOURNAL_SECTOR. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    unsigned seq;                       /* First transaction in the log. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 2 * sizeof (unsigned)];
+  };
+
+/* On-disk descriptor, the first sector of a transaction. */
+struct journal_desc
+  {
+    unsigned magic;                     /* DESC_MAGIC. */
+    unsigned seq;                       /* Sequence number. */
+    unsigned cnt;                       /* Number of blocks. */
+    block_sector_t sectors[DESC_CNT];   /* Home sector of each block. */
+  };
+
+/* On-disk commit record, the last sector of a transaction. */
+struct journal_commit
+  {
+    unsigned magic;                     /* COMMIT_MAGIC. */
+    unsigned seq;                       /* Sequence number. */
+    unsigned cnt;                       /* Number of blocks. */
+    unsigned checksum;                  /* Of descriptor and blocks. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 4 * sizeof (unsigned)];
+  };
+
+static bool active;                     /* Journaling is on. */
+static unsigned next_seq;               /* Sequence of next transaction. */
+static size_t head;                     /* Next free log sector. */
+static unsigned generation;             /* Number of log restarts. */
+
+/* Operations in progress, and a commit waiting for them. */
+static struct lock handle_lock;
+static struct condition handles_done;
+static struct condition commit_done;
+static int handle_cnt;
+static bool committing;
+static size_t reserved;                 /* Blocks reserved by handles. */
+static size_t op_credits;               /* Blocks reserved per handle. */
+
+/* Statistics. */
+static long long commit_cnt, logged_cnt, restart_cnt, replay_cnt;
+
+static void journal_daemon (void *aux);
+
+/* Returns the number of blocks one operation may dirty on the
+   file system device: JOURNAL_OP_BLOCKS, plus the free map's
+   sectors and its inode. */
+static size_t
+credits_per_op (void)
+{
+  return (JOURNAL_OP_BLOCKS + 1
+          + DIV_ROUND_UP (block_size (fs_device), BLOCK_SECTOR_SIZE * 8));
+}
+
+/* Returns true if the file system device is big enough for a
+   journal, yet small enough that an operation that rewrites its
+   whole free map still fits in one transaction. */
+bool
+journal_fits (void)
+{
+  return (block_size (fs_device) >= JOURNAL_MIN_DISK
+          && credits_per_op () <= JOURNAL_TXN_MAX);
+}
+
+/* Returns the sector of log position POS. */
+static block_sector_t
+log_sector (size_t pos)
+{
+  return JOURNAL_SECTOR + 1 + pos;
+}
+
+/* Writes a header naming SEQ as the first transaction in the
+   log. */
+static void
+write_header (unsigned seq)
+{
+  static struct journal_header header;
+
+  header.magic = JOURNAL_MAGIC;
+  header.seq = seq;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+static unsigned
+checksum (const struct journal_desc *desc, void *buffers[], size_t cnt)
+{
+  unsigned sum = hash_bytes (desc, sizeof *desc);
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    sum = sum * 31 + hash_bytes (buffers[i], BLOCK_SECTOR_SIZE);
+  return sum;
+}
+
+/* Creates an empty journal on a newly formatted disk, if the disk
+   is big enough.  free_map_init() has already reserved its
+   sectors. */
+void
+journal_format (void)
+{
+  static uint8_t zeros[BLOCK_SECTOR_SIZE];
+
+  if (!journal_fits ())
+    return;
+  block_write (fs_device, log_sector (0), zeros);
+  write_header (1);
+}
+
+/* Reads and checks transaction SEQ at log position POS, storing
+   its descriptor into *DESC and its blocks into BUFFERS.
+   Returns true if the transaction was committed in full. */
+static bool
+read_txn (size_t pos, unsigned seq, struct journal_desc *desc,
+          void *buffers[])
+{
+  static struct journal_commit commit;
+  size_t i;
+
+  if (pos + 2 > JOURNAL_SECTORS)
+    return false;
+  block_read (fs_device, log_sector (pos), desc);
+  if (desc->magic != DESC_MAGIC || desc->seq != seq
+      || desc->cnt == 0 || desc->cnt > JOURNAL_TXN_MAX
+      || pos + desc->cnt + 2 > JOURNAL_SECTORS)
+    return false;
+
+  for (i = 0; i < desc->cnt; i++)
+    block_read (fs_device, log_sector (pos + 1 + i), buffers[i]);
+  block_read (fs_device, log_sector (pos + 1 + desc->cnt), &commit);
+  return (commit.magic == COMMIT_MAGIC && commit.seq == seq
+          && commit.cnt == desc->cnt
+          && commit.checksum == checksum (desc, buffers, desc->cnt));
+}
+
+/* Copies the blocks of every committed transaction in the log to
+   their home locations, then empties the log. */
+static void
+replay (unsigned seq)
+{
+  struct journal_desc *desc = malloc (sizeof *desc);
+  uint8_t *data = malloc (JOURNAL_TXN_MAX * BLOCK_SECTOR_SIZE);
+  void *buffers[JOURNAL_TXN_MAX];
+  size_t pos = 0;
+  size_t i;
+
+  if (desc == NULL || data == NULL)
+    PANIC ("journal replay: out of memory");
+  for (i = 0; i < JOURNAL_TXN_MAX; i++)
+    buffers[i] = data + i * BLOCK_SECTOR_SIZE;
+
+  while (read_txn (pos, seq, desc, buffers))
+    {
+      for (i = 0; i < desc->cnt; i++)
+        block_write (fs_device, desc->sectors[i], buffers[i]);
+      pos += desc->cnt + 2;
+      seq++;
+      replay_cnt++;
+    }
+  if (replay_cnt > 0)
+    printf ("Journal: replayed %lld transactions.\n", replay_cnt);
+
+  free (data);
+  free (desc);
+  next_seq = seq;
+  journal_reset ();
+}
+
+/* Replays the journal, if the file system has one, and turns on
+   journaling.  Must be called after any formatting and before
+   any metadata is read. */
+void
+journal_init (void)
+{
+  struct journal_header *header;
+
+  ASSERT (DESC_CNT >= JOURNAL_TXN_MAX);
+  ASSERT (sizeof (struct journal_desc) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&handle_lock);
+  cond_init (&handles_done);
+  cond_init (&commit_done);
+
+  if (!journal_fits ())
+    return;
+  op_credits = credits_per_op ();
+  header = malloc (sizeof *header);
+  if (header == NULL)
+    PANIC ("journal: out of memory");
+  block_read (fs_device, JOURNAL_SECTOR, header);
+  if (header->magic == JOURNAL_MAGIC)
+    {
+      replay (header->seq);
+      active = true;
+      thread_create ("journal", PRI_DEFAULT, journal_daemon, NULL);
+    }
+  free (header);
+}
+
+/* Commits the running transaction, writes everything home and
+   turns journaling off, leaving an empty log. */
+void
+journal_done (void)
+{
+  if (!active)
+    return;
+  journal_commit ();
+  buffer_cache_flush_all ();
+  journal_reset ();
+  active = false;
+}
+
+/* Returns true if metadata updates are being journaled. */
+bool
+journal_active (void)
+{
+  return active;
+}
+
+/* Returns the number of times the log has started over.  A block
+   freed while this has some value may still have a copy in the
+   log, which replay would write over whatever the block is used
+   for next, until the value changes. */
+unsigned
+journal_generation (void)
+{
+  return generation;
+}
+
+/* Commits the running transaction.  The caller holds handle_lock
+   and has set COMMITTING, and no operation is in progress. */
+static void
+commit_locked (void)
+{
+  ASSERT (lock_held_by_current_thread (&handle_lock));
+  ASSERT (committing && handle_cnt == 0);
+
+  lock_release (&handle_lock);
+  buffer_cache_commit ();
+  lock_acquire (&handle_lock);
+  committing = false;
+  cond_broadcast (&commit_done, &handle_lock);
+}
+
+/* Starts a file system operation, whose metadata updates should
+   be committed together, reserving room for it in the running
+   transaction.  Operations may nest; only the outermost one
+   reserves room. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!active || t->journal_depth++ > 0)
+    return;
+  lock_acquire (&handle_lock);
+  for (;;)
+    {
+      if (committing)
+        cond_wait (&commit_done, &handle_lock);
+      else if (buffer_cache_txn_size () + reserved + op_credits
+               <= JOURNAL_TXN_MAX)
+        break;
+      else if (handle_cnt > 0)
+        cond_wait (&handles_done, &handle_lock);
+      else
+        {
+          /* No room, and nothing in progress: commit now. */
+          committing = true;
+          commit_locked ();
+        }
+    }
+  handle_cnt++;
+  reserved += op_credits;
+  lock_release (&handle_lock);
+}
+
+/* Ends the operation started by the matching journal_begin(),
+   committing the running transaction if it has grown large. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!active || --t->journal_depth > 0)
+    return;
+  lock_acquire (&handle_lock);
+  reserved -= op_credits;
+  if (--handle_cnt == 0)
+    cond_broadcast (&handles_done, &handle_lock);
+  lock_release (&handle_lock);
+
+  if (buffer_cache_txn_size () >= JOURNAL_TXN_TARGET)
+    journal_commit ();
+}
+
+/* Commits the running transaction once the operations in
+   progress have ended.  Must not be called from inside an
+   operation. */
+void
+journal_commit (void)
+{
+  if (!active)
+    return;
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&handle_lock);
+  while (committing)
+    cond_wait (&commit_done, &handle_lock);
+  committing = true;
+  while (handle_cnt > 0)
+    cond_wait (&handles_done, &handle_lock);
+  commit_locked ();
+  lock_release (&handle_lock);
+}
+
+/* Commits the running transaction once the operations in
+   progress have ended, writes every dirty metadata block home and
+   empties the log, so that sectors freed since the last restart
+   can be reused.  Does nothing, returning false, if journaling is
+   off or the caller is inside an operation, which must not be
+   split. */
+bool
+journal_checkpoint (void)
+{
+  if (!active || thread_current ()->journal_depth > 0)
+    return false;
+
+  lock_acquire (&handle_lock);
+  while (committing)
+    cond_wait (&commit_done, &handle_lock);
+  committing = true;
+  while (handle_cnt > 0)
+    cond_wait (&handles_done, &handle_lock);
+  lock_release (&handle_lock);
+
+  buffer_cache_checkpoint ();
+
+  lock_acquire (&handle_lock);
+  committing = false;
+  cond_broadcast (&commit_done, &handle_lock);
+  lock_release (&handle_lock);
+  return true;
+}
+
+/* Appends a transaction of CNT blocks, whose contents are in
+   BUFFERS and which belong in SECTORS, to the log, and waits for
+   it to reach the disk.  Called by the buffer cache.  Returns
+   true if the log must be emptied with journal_reset(), after
+   writing every dirty metadata block home, before the next
+   transaction. */
+bool
+journal_log (const block_sector_t sectors[], void *buffers[], size_t cnt)
+{
+  static struct journal_desc desc;
+  static struct journal_commit commit;
+  static struct bio bios[JOURNAL_TXN_MAX + 1];
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= JOURNAL_TXN_MAX);
+  ASSERT (head + cnt + 2 <= JOURNAL_SECTORS);
+
+  memset (&desc, 0, sizeof desc);
+  desc.magic = DESC_MAGIC;
+  desc.seq = next_seq;
+  desc.cnt = cnt;
+  memcpy (desc.sectors, sectors, cnt * sizeof *sectors);
+
+  /* The commit record may only be written once everything it
+     vouches for is on disk. */
+  bio_init (&bios[0], log_sector (head), &desc, 1, true);
+  block_submit (fs_device, &bios[0]);
+  for (i = 0; i < cnt; i++)
+    {
+      bio_init (&bios[i + 1], log_sector (head + 1 + i), buffers[i], 1, true);
+      block_submit (fs_device, &bios[i + 1]);
+    }
+  for (i = 0; i <= cnt; i++)
+    block_wait (fs_device, &bios[i]);
+
+  commit.magic = COMMIT_MAGIC;
+  commit.seq = next_seq;
+  commit.cnt = cnt;
+  commit.checksum = checksum (&desc, buffers, cnt);
+  block_write (fs_device, log_sector (head + 1 + cnt), &commit);
+
+  head += cnt + 2;
+  next_seq++;
+  commit_cnt++;
+  logged_cnt += cnt;
+  return head + JOURNAL_TXN_MAX + 2 > JOURNAL_SECTORS;
+}
+
+/* Empties the log.  Every block logged so far must already be at
+   its home location. */
+void
+journal_reset (void)
+{
+  write_header (next_seq);
+  head = 0;
+  generation++;
+  restart_cnt++;
+}
+
+/* Commits the running transaction every COMMIT_INTERVAL
+   ticks. */
+static void
+journal_daemon (void *aux UNUSED)
+{
+  while (active)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      if (buffer_cache_txn_size () > 0)
+        journal_commit ();
+    }
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  if (commit_cnt == 0 && replay_cnt == 0)
+    return;
+  printf ("Journal: %lld commits of %lld blocks, %lld restarts, "
+          "%lld transactions replayed\n",
+          commit_cnt, logged_cnt, restart_cnt, replay_cnt);
+}
@@ -0,0 +1,38 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* The journal header is in sector JOURNAL_SECTOR, followed by
+   JOURNAL_SECTORS sectors of log.  Disks smaller than
+   JOURNAL_MIN_DISK sectors get no journal. */
+#define JOURNAL_SECTORS 256
+#define JOURNAL_MIN_DISK (16 * JOURNAL_SECTORS)
+
+/* Most metadata blocks in one transaction. */
+#define JOURNAL_TXN_MAX 64
+
+/* Most metadata blocks, not counting the free map, that one
+   operation may dirty.  Bigger operations are done in steps. */
+#define JOURNAL_OP_BLOCKS 24
+
+bool journal_fits (void);
+void journal_format (void);
+void journal_init (void);
+void journal_done (void);
+bool journal_active (void);
+unsigned journal_generation (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_commit (void);
+bool journal_checkpoint (void);
+
+bool journal_log (const block_sector_t sectors[], void *buffers[],
+                  size_t cnt);
+void journal_reset (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,529 @@
+#include "filesys/page-cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Page cache.
+
+   Regular file data is cached a page at a time, keyed by the
+   sector of the file's inode and the page's index within the
+   file, while the sector-sized buffer cache holds only metadata.
+   Each page covers BLOCKS_PER_PAGE consecutive blocks of the
+   file, which need not be consecutive on disk, so it records the
+   sector of each block along with whether the block is valid and
+   whether it is dirty.
+
+   A read that misses fills every block of its page that the file
+   has, submitting the reads together so that the block layer can
+   merge runs of adjacent sectors.  Writes never read a block that
+   they overwrite completely.
+
+   The pages of each file are also linked from a per-file record,
+   found by inode sector, so that flushing or discarding one file
+   looks only at that file's pages.
+
+   Pages come from the kernel pool as they are needed, up to a
+   limit, for as long as the pool keeps GROW_RESERVE pages free.
+   Beyond that the least recently used page is reused.  When the
+   kernel pool runs out, the page allocator calls
+   page_cache_shrink() to give back clean pages. */
+
+#define BLOCKS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+#define GROW_RESERVE 32
+#define PAGE_CACHE_MIN 8                /* Never shrink below this. */
+#define PAGE_CACHE_DEFAULT_SHARE 4      /* Default max: 1/4 of kernel pool. */
+
+/* The cached pages of one file. */
+struct cached_file
+  {
+    struct hash_elem hash_elem;         /* Element in file_map. */
+    block_sector_t inode;               /* Sector of the file's inode. */
+    struct list pages;                  /* Its pages, in no order. */
+  };
+
+/* A cached page of file data. */
+struct cached_page
+  {
+    struct hash_elem hash_elem;         /* Element in page_map. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    struct list_elem file_elem;         /* Element in file->pages. */
+    struct cached_file *file;           /* File the page belongs to. */
+    block_sector_t inode;               /* Sector of the file's inode. */
+    size_t page_idx;                    /* Page index within the file. */
+    uint8_t *kpage;                     /* Page contents. */
+    unsigned valid;                     /* Bit set per valid block. */
+    unsigned dirty;                     /* Bit set per dirty block. */
+    block_sector_t sectors[BLOCKS_PER_PAGE]; /* Sector of each block. */
+  };
+
+static struct lock page_cache_lock;
+static struct hash page_map;            /* All cached pages. */
+static struct hash file_map;            /* Files with cached pages. */
+static struct list lru_list;            /* Least recently used first. */
+static size_t page_cnt;                 /* Number of cached pages. */
+static size_t max_pages;                /* Limit on page_cnt. */
+static struct kmem_cache *page_struct_cache;
+static struct kmem_cache *file_struct_cache;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, fill_cnt, writeback_cnt, shrink_cnt;
+
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cached_page *p = hash_entry (e, struct cached_page, hash_elem);
+  return hash_int (p->inode) ^ hash_int (p->page_idx);
+}
+
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct cached_page *a = hash_entry (a_, struct cached_page, hash_elem);
+  const struct cached_page *b = hash_entry (b_, struct cached_page, hash_elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  return a->page_idx < b->page_idx;
+}
+
+static unsigned
+file_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct cached_file, hash_elem)->inode);
+}
+
+static bool
+file_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return (hash_entry (a, struct cached_file, hash_elem)->inode
+          < hash_entry (b, struct cached_file, hash_elem)->inode);
+}
+
+/* Sets up a page cache of up to MAX pages, or if MAX is 0, of up
+   to 1/PAGE_CACHE_DEFAULT_SHARE of the free kernel pool. */
+void
+page_cache_init (size_t max)
+{
+  if (max == 0)
+    max = palloc_free_pages (0) / PAGE_CACHE_DEFAULT_SHARE;
+  if (max < PAGE_CACHE_MIN)
+    max = PAGE_CACHE_MIN;
+  max_pages = max;
+
+  lock_init (&page_cache_lock);
+  list_init (&lru_list);
+  page_struct_cache = kmem_cache_create ("cached_page",
+                                         sizeof (struct cached_page), NULL);
+  file_struct_cache = kmem_cache_create ("cached_file",
+                                         sizeof (struct cached_file), NULL);
+  if (page_struct_cache == NULL || file_struct_cache == NULL
+      || !hash_init (&page_map, page_hash, page_less, NULL)
+      || !hash_init (&file_map, file_hash, file_less, NULL))
+    PANIC ("page cache initialization failed");
+  palloc_add_reclaim (page_cache_shrink);
+}
+
+/* Writes P's dirty blocks back to disk. */
+static void
+write_back (struct cached_page *p) 
+{
+  static struct bio bios[BLOCKS_PER_PAGE];
+  int i;
+
+  ASSERT (lock_held_by_current_thread (&page_cache_lock));
+
+  if (p->dirty == 0)
+    return;
+  for (i = 0; i < BLOCKS_PER_PAGE; i++)
+    if (p->dirty & (1u << i))
+      {
+        bio_init (&bios[i], p->sectors[i], p->kpage + i * BLOCK_SECTOR_SIZE,
+                  1, true);
+        block_submit (fs_device, &bios[i]);
+        writeback_cnt++;
+      }
+  for (i = 0; i < BLOCKS_PER_PAGE; i++)
+    if (p->dirty & (1u << i))
+      block_wait (fs_device, &bios[i]);
+  p->dirty = 0;
+}
+
+/* Returns the record of the file whose inode is in sector INODE,
+   or a null pointer if none of its pages are cached. */
+static struct cached_file *
+find_file (block_sector_t inode) 
+{
+  struct cached_file key;
+  struct hash_elem *e;
+
+  key.inode = inode;
+  e = hash_find (&file_map, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cached_file, hash_elem) : NULL;
+}
+
+/* Adds P, whose inode and page index are set, to the lookup
+   tables, creating its file's record if this is the file's first
+   cached page. */
+static void
+add_page (struct cached_page *p) 
+{
+  struct cached_file *f = find_file (p->inode);
+
+  if (f == NULL) 
+    {
+      f = kmem_cache_alloc (file_struct_cache);
+      if (f == NULL)
+        PANIC ("page cache: out of memory");
+      f->inode = p->inode;
+      list_init (&f->pages);
+      hash_insert (&file_map, &f->hash_elem);
+    }
+  p->file = f;
+  list_push_back (&f->pages, &p->file_elem);
+  hash_insert (&page_map, &p->hash_elem);
+}
+
+/* Removes P from the lookup tables, freeing its file's record if
+   it was the file's last cached page. */
+static void
+remove_page (struct cached_page *p) 
+{
+  hash_delete (&page_map, &p->hash_elem);
+  list_remove (&p->file_elem);
+  if (list_empty (&p->file->pages)) 
+    {
+      hash_delete (&file_map, &p->file->hash_elem);
+      kmem_cache_free (file_struct_cache, p->file);
+    }
+  p->file = NULL;
+}
+
+/* Removes P from the cache and frees it, without writing it
+   back. */
+static void
+drop_page (struct cached_page *p) 
+{
+  remove_page (p);
+  list_remove (&p->lru_elem);
+  palloc_free_page (p->kpage);
+  kmem_cache_free (page_struct_cache, p);
+  page_cnt--;
+}
+
+/* Returns the cached page of INODE with index PAGE_IDX, adding an
+   empty one if it is not cached, and marks it most recently
+   used. */
+static struct cached_page *
+get_page (block_sector_t inode, size_t page_idx) 
+{
+  struct cached_page key, *p;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&page_cache_lock));
+
+  key.inode = inode;
+  key.page_idx = page_idx;
+  e = hash_find (&page_map, &key.hash_elem);
+  if (e != NULL) 
+    {
+      p = hash_entry (e, struct cached_page, hash_elem);
+      list_remove (&p->lru_elem);
+      list_push_back (&lru_list, &p->lru_elem);
+      return p;
+    }
+
+  /* Take a new page while under the limit and memory is plentiful,
+     otherwise reuse the least recently used one. */
+  p = NULL;
+  if (page_cnt < max_pages && palloc_free_pages (0) > GROW_RESERVE) 
+    {
+      p = kmem_cache_alloc (page_struct_cache);
+      if (p != NULL) 
+        {
+          p->kpage = palloc_get_page (0);
+          if (p->kpage == NULL) 
+            {
+              kmem_cache_free (page_struct_cache, p);
+              p = NULL;
+            }
+          else
+            page_cnt++;
+        }
+    }
+  if (p == NULL && !list_empty (&lru_list)) 
+    {
+      p = list_entry (list_pop_front (&lru_list), struct cached_page, lru_elem);
+      write_back (p);
+      remove_page (p);
+    }
+  if (p == NULL) 
+    {
+      p = kmem_cache_alloc (page_struct_cache);
+      if (p == NULL)
+        PANIC ("page cache: out of memory");
+      p->kpage = palloc_get_page (PAL_ASSERT);
+      page_cnt++;
+    }
+
+  p->inode = inode;
+  p->page_idx = page_idx;
+  p->valid = p->dirty = 0;
+  add_page (p);
+  list_push_back (&lru_list, &p->lru_elem);
+  return p;
+}
+
+/* Reads every block of P that is not yet valid and that the file
+   has, according to MAP and AUX.  The sector of block B, which
+   the caller needs, is already known to be SECTOR. */
+static void
+fill_page (struct cached_page *p, int b, block_sector_t sector,
+           page_cache_map_func *map, void *aux) 
+{
+  static struct bio bios[BLOCKS_PER_PAGE];
+  unsigned reading = 0;
+  int i;
+
+  for (i = 0; i < BLOCKS_PER_PAGE; i++)
+    {
+      if (p->valid & (1u << i))
+        continue;
+      if (i == b)
+        p->sectors[i] = sector;
+      else
+        {
+          p->sectors[i] = map (aux, p->page_idx * BLOCKS_PER_PAGE + i);
+          if (p->sectors[i] == (block_sector_t) -1)
+            continue;
+        }
+      bio_init (&bios[i], p->sectors[i], p->kpage + i * BLOCK_SECTOR_SIZE,
+                1, false);
+      block_submit (fs_device, &bios[i]);
+      reading |= 1u << i;
+      fill_cnt++;
+    }
+  for (i = 0; i < BLOCKS_PER_PAGE; i++)
+    if (reading & (1u << i))
+      block_wait (fs_device, &bios[i]);
+  p->valid |= reading;
+}
+
+/* Copies SIZE bytes starting at offset OFS within block BLOCK_IDX
+   of the file whose inode is in sector INODE into BUFFER.  The
+   block is stored in SECTOR.  On a miss, the rest of the block's
+   page is read too, using MAP and AUX to find its sectors. */
+void
+page_cache_read (block_sector_t inode, size_t block_idx,
+                 block_sector_t sector, void *buffer, int ofs, int size,
+                 page_cache_map_func *map, void *aux)
+{
+  struct cached_page *p;
+  int b = block_idx % BLOCKS_PER_PAGE;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&page_cache_lock);
+  p = get_page (inode, block_idx / BLOCKS_PER_PAGE);
+  if (p->valid & (1u << b))
+    hit_cnt++;
+  else
+    {
+      miss_cnt++;
+      fill_page (p, b, sector, map, aux);
+    }
+  memcpy (buffer, p->kpage + b * BLOCK_SECTOR_SIZE + ofs, size);
+  lock_release (&page_cache_lock);
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS within block
+   BLOCK_IDX, stored in SECTOR, of the file whose inode is in
+   sector INODE.  The block is read first only if it is not cached
+   and the write does not cover all of it. */
+void
+page_cache_write (block_sector_t inode, size_t block_idx,
+                  block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cached_page *p;
+  int b = block_idx % BLOCKS_PER_PAGE;
+  uint8_t *data;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&page_cache_lock);
+  p = get_page (inode, block_idx / BLOCKS_PER_PAGE);
+  data = p->kpage + b * BLOCK_SECTOR_SIZE;
+  if (p->valid & (1u << b))
+    hit_cnt++;
+  else 
+    {
+      miss_cnt++;
+      if (ofs > 0 || size < BLOCK_SECTOR_SIZE) 
+        {
+          block_read (fs_device, sector, data);
+          fill_cnt++;
+        }
+    }
+  p->sectors[b] = sector;
+  memcpy (data + ofs, buffer, size);
+  p->valid |= 1u << b;
+  p->dirty |= 1u << b;
+  lock_release (&page_cache_lock);
+}
+
+/* Zero-fills newly allocated block BLOCK_IDX, stored in SECTOR, of
+   the file whose inode is in sector INODE, without reading it. */
+void
+page_cache_zero (block_sector_t inode, size_t block_idx,
+                 block_sector_t sector)
+{
+  struct cached_page *p;
+  int b = block_idx % BLOCKS_PER_PAGE;
+
+  lock_acquire (&page_cache_lock);
+  p = get_page (inode, block_idx / BLOCKS_PER_PAGE);
+  memset (p->kpage + b * BLOCK_SECTOR_SIZE, 0, BLOCK_SECTOR_SIZE);
+  p->sectors[b] = sector;
+  p->valid |= 1u << b;
+  p->dirty |= 1u << b;
+  lock_release (&page_cache_lock);
+}
+
+/* Writes back the dirty pages of the file whose inode is in
+   sector INODE. */
+void
+page_cache_flush_inode (block_sector_t inode) 
+{
+  struct cached_file *f;
+  struct list_elem *e;
+
+  lock_acquire (&page_cache_lock);
+  f = find_file (inode);
+  if (f != NULL)
+    for (e = list_begin (&f->pages); e != list_end (&f->pages);
+         e = list_next (e))
+      write_back (list_entry (e, struct cached_page, file_elem));
+  lock_release (&page_cache_lock);
+}
+
+/* Drops the cached pages of the file whose inode is in sector
+   INODE without writing them back, for when its blocks are being
+   freed. */
+void
+page_cache_discard_inode (block_sector_t inode) 
+{
+  page_cache_discard_blocks (inode, 0, SIZE_MAX);
+}
+
+/* Drops CNT blocks, starting at block FIRST, of the file whose
+   inode is in sector INODE from the cache without writing them
+   back, for when those blocks are being freed.  CNT may be
+   SIZE_MAX, meaning every block from FIRST on. */
+void
+page_cache_discard_blocks (block_sector_t inode, size_t first, size_t cnt)
+{
+  size_t end = cnt < SIZE_MAX - first ? first + cnt : SIZE_MAX;
+  struct cached_file *f;
+  struct list_elem *e, *tail;
+
+  lock_acquire (&page_cache_lock);
+  f = find_file (inode);
+  if (f == NULL) 
+    {
+      lock_release (&page_cache_lock);
+      return;
+    }
+
+  /* Dropping the last page frees F, so TAIL is only compared
+     against, never followed. */
+  tail = list_end (&f->pages);
+  for (e = list_begin (&f->pages); e != tail; )
+    {
+      struct cached_page *p = list_entry (e, struct cached_page, file_elem);
+      size_t start = p->page_idx * BLOCKS_PER_PAGE;
+      unsigned drop = 0;
+      int i;
+
+      e = list_next (e);
+      if (start + BLOCKS_PER_PAGE <= first || start >= end)
+        continue;
+      for (i = 0; i < BLOCKS_PER_PAGE; i++)
+        if (start + i >= first && start + i < end)
+          drop |= 1u << i;
+      if (drop == (1u << BLOCKS_PER_PAGE) - 1)
+        drop_page (p);
+      else
+        {
+          p->valid &= ~drop;
+          p->dirty &= ~drop;
+        }
+    }
+  lock_release (&page_cache_lock);
+}
+
+/* Writes back every dirty page. */
+void
+page_cache_flush_all (void) 
+{
+  struct list_elem *e;
+
+  lock_acquire (&page_cache_lock);
+  for (e = list_begin (&lru_list); e != list_end (&lru_list);
+       e = list_next (e))
+    write_back (list_entry (e, struct cached_page, lru_elem));
+  lock_release (&page_cache_lock);
+}
+
+/* Frees the least recently used clean page, if the cache holds
+   more than PAGE_CACHE_MIN pages.  Called by the page allocator
+   when the kernel pool is exhausted.  Returns true if a page was
+   freed. */
+bool
+page_cache_shrink (void) 
+{
+  struct list_elem *e;
+  bool success = false;
+
+  if (lock_held_by_current_thread (&page_cache_lock)
+      || !lock_try_acquire (&page_cache_lock))
+    return false;
+
+  if (page_cnt > PAGE_CACHE_MIN)
+    for (e = list_begin (&lru_list); e != list_end (&lru_list);
+         e = list_next (e))
+      {
+        struct cached_page *p = list_entry (e, struct cached_page, lru_elem);
+        if (p->dirty == 0)
+          {
+            drop_page (p);
+            shrink_cnt++;
+            success = true;
+            break;
+          }
+      }
+
+  lock_release (&page_cache_lock);
+  return success;
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) 
+{
+  long long total = hit_cnt + miss_cnt;
+
+  printf ("Page cache: %zu of up to %zu pages, %lld shrinks\n",
+          page_cnt, max_pages, shrink_cnt);
+  printf ("Page cache: %lld hits, %lld misses (%lld%% hit rate), "
+          "%lld blocks read, %lld blocks written\n",
+          hit_cnt, miss_cnt, total ? hit_cnt * 100 / total : 0,
+          fill_cnt, writeback_cnt);
+}
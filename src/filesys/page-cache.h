@@ -0,0 +1,29 @@
+#ifndef FILESYS_PAGE_CACHE_H
+#define FILESYS_PAGE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Returns the sector holding block BLOCK_IDX of the file described
+   by AUX, or (block_sector_t) -1 if the file has no such block. */
+typedef block_sector_t page_cache_map_func (void *aux, size_t block_idx);
+
+void page_cache_init (size_t max_pages);
+void page_cache_read (block_sector_t inode, size_t block_idx,
+                      block_sector_t sector, void *buffer, int ofs, int size,
+                      page_cache_map_func *, void *aux);
+void page_cache_write (block_sector_t inode, size_t block_idx,
+                       block_sector_t sector, const void *buffer,
+                       int ofs, int size);
+void page_cache_zero (block_sector_t inode, size_t block_idx,
+                      block_sector_t sector);
+void page_cache_flush_inode (block_sector_t inode);
+void page_cache_discard_inode (block_sector_t inode);
+void page_cache_discard_blocks (block_sector_t inode, size_t first,
+                                size_t cnt);
+void page_cache_flush_all (void);
+bool page_cache_shrink (void);
+void page_cache_print_stats (void);
+
+#endif /* filesys/page-cache.h */
@@ -0,0 +1,17 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+
+/* Longest file name in a directory entry. */
+#define DIRENT_NAME_MAX 14
+
+/* One directory entry returned by getdents(). */
+struct dirent
+  {
+    int inumber;                        /* Inode number. */
+    bool is_dir;                        /* Is it a directory? */
+    char name[DIRENT_NAME_MAX + 1];     /* Null terminated file name. */
+  };
+
+#endif /* lib/dirent.h */
@@ -28,7 +28,19 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_READV,                  /* Read from a file into several buffers. */
+    SYS_WRITEV,                 /* Write to a file from several buffers. */
+    SYS_PREAD,                  /* Read from a file at a given offset. */
+    SYS_PWRITE,                 /* Write to a file at a given offset. */
+    SYS_FSYNC,                  /* Flush one file's changes to disk. */
+    SYS_SYNC,                   /* Flush all file system changes to disk. */
+    SYS_GETDENTS,               /* Read many directory entries. */
+    SYS_FALLOCATE,              /* Allocate disk space for a file. */
+    SYS_FTRUNCATE,              /* Change a file's length. */
+    SYS_PUNCH_HOLE              /* Free part of a file's disk space. */
   };
 
 #endif /* lib/syscall-nr.h */
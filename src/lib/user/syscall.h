@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <dirent.h>
+#include <uio.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +47,16 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int fsync (int fd);
+void sync (void);
+int getdents (int fd, struct dirent *ents, int cnt);
+int fallocate (int fd, unsigned length);
+int ftruncate (int fd, unsigned length);
+int punch_hole (int fd, unsigned offset, unsigned length);
+
 #endif /* lib/user/syscall.h */
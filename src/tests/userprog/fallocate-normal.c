@@ -0,0 +1,39 @@
+/* Reserves space for an empty file with fallocate(), writes into
+   the middle of it, and checks that the rest reads as zeros and
+   that a smaller fallocate() does not shrink it. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[20000];
+
+void
+test_main (void) 
+{
+  int handle, byte_cnt;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  CHECK (fallocate (handle, sizeof buf) == 0, "fallocate %zu bytes",
+         sizeof buf);
+  CHECK (filesize (handle) == sizeof buf, "filesize is %zu", sizeof buf);
+
+  byte_cnt = pwrite (handle, sample, sizeof sample - 1, 10000);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("pwrite() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+
+  CHECK (fallocate (handle, 100) == 0, "fallocate 100 bytes");
+  CHECK (filesize (handle) == sizeof buf, "filesize is still %zu",
+         sizeof buf);
+  CHECK (fallocate (STDOUT_FILENO, 100) == -1,
+         "fallocate stdout (must return -1)");
+  close (handle);
+
+  memcpy (buf + 10000, sample, sizeof sample - 1);
+  check_file ("test.txt", buf, sizeof buf);
+}
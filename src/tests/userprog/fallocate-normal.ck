@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fallocate-normal) begin
+(fallocate-normal) create "test.txt"
+(fallocate-normal) open "test.txt"
+(fallocate-normal) fallocate 20000 bytes
+(fallocate-normal) filesize is 20000
+(fallocate-normal) fallocate 100 bytes
+(fallocate-normal) filesize is still 20000
+(fallocate-normal) fallocate stdout (must return -1)
+(fallocate-normal) open "test.txt" for verification
+(fallocate-normal) verified contents of "test.txt"
+(fallocate-normal) close "test.txt"
+(fallocate-normal) end
+fallocate-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,30 @@
+/* Writes a file, flushes it with fsync() and sync(), and checks
+   that fsync() rejects descriptors that are not open files. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int handle, byte_cnt;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  byte_cnt = write (handle, sample, sizeof sample - 1);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("write() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+
+  CHECK (fsync (handle) == 0, "fsync \"test.txt\"");
+  CHECK (fsync (STDOUT_FILENO) == -1, "fsync stdout (must return -1)");
+  CHECK (fsync (0x20101234) == -1, "fsync bad fd (must return -1)");
+  sync ();
+  msg ("sync");
+  close (handle);
+
+  check_file ("test.txt", sample, sizeof sample - 1);
+}
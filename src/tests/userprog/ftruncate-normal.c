@@ -0,0 +1,44 @@
+/* Writes a file that needs an indirect block, shrinks it with
+   ftruncate() to less than a sector, then grows it again and
+   checks that the old data past the cut reads back as zeros. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[8192];
+static char zeros[3000];
+
+void
+test_main (void) 
+{
+  int handle, byte_cnt;
+  size_t ofs;
+
+  for (ofs = 0; ofs < sizeof buf; ofs += sizeof sample - 1)
+    memcpy (buf + ofs, sample, ofs + sizeof sample - 1 <= sizeof buf
+                               ? sizeof sample - 1 : sizeof buf - ofs);
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+  byte_cnt = write (handle, buf, sizeof buf);
+  if (byte_cnt != sizeof buf)
+    fail ("write() returned %d instead of %zu", byte_cnt, sizeof buf);
+
+  CHECK (ftruncate (handle, 100) == 0, "ftruncate to 100 bytes");
+  CHECK (filesize (handle) == 100, "filesize is 100");
+  CHECK (ftruncate (handle, sizeof zeros) == 0, "ftruncate to %zu bytes",
+         sizeof zeros);
+  CHECK (filesize (handle) == sizeof zeros, "filesize is %zu", sizeof zeros);
+  CHECK (ftruncate (handle, 9000000) == -1,
+         "ftruncate past largest file size (must return -1)");
+  CHECK (ftruncate (STDOUT_FILENO, 0) == -1,
+         "ftruncate stdout (must return -1)");
+  close (handle);
+
+  memcpy (zeros, buf, 100);
+  check_file ("test.txt", zeros, sizeof zeros);
+}
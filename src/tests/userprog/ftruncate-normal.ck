@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ftruncate-normal) begin
+(ftruncate-normal) create "test.txt"
+(ftruncate-normal) open "test.txt"
+(ftruncate-normal) ftruncate to 100 bytes
+(ftruncate-normal) filesize is 100
+(ftruncate-normal) ftruncate to 3000 bytes
+(ftruncate-normal) filesize is 3000
+(ftruncate-normal) ftruncate past largest file size (must return -1)
+(ftruncate-normal) ftruncate stdout (must return -1)
+(ftruncate-normal) open "test.txt" for verification
+(ftruncate-normal) verified contents of "test.txt"
+(ftruncate-normal) close "test.txt"
+(ftruncate-normal) end
+ftruncate-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Creates three files, reads the root directory two entries at a
+   time with getdents(), and checks that each file turns up once,
+   as a file, with its inode number. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char *names[] = {"a.txt", "b.txt", "c.txt"};
+
+void
+test_main (void) 
+{
+  struct dirent ents[2];
+  int found[3] = {0, 0, 0};
+  int dir_fd, cnt, i, j;
+
+  for (i = 0; i < 3; i++)
+    CHECK (create (names[i], 0), "create \"%s\"", names[i]);
+  CHECK ((dir_fd = open ("/")) > 1, "open \"/\"");
+
+  while ((cnt = getdents (dir_fd, ents, 2)) > 0)
+    {
+      if (cnt > 2)
+        fail ("getdents() returned %d entries, asked for 2", cnt);
+      for (i = 0; i < cnt; i++)
+        for (j = 0; j < 3; j++)
+          if (!strcmp (ents[i].name, names[j]))
+            {
+              int fd = open (names[j]);
+              if (ents[i].is_dir)
+                fail ("\"%s\" listed as a directory", names[j]);
+              if (ents[i].inumber != inumber (fd))
+                fail ("wrong inumber for \"%s\"", names[j]);
+              close (fd);
+              found[j]++;
+            }
+    }
+  if (cnt != 0)
+    fail ("getdents() returned %d at end of directory", cnt);
+  for (j = 0; j < 3; j++)
+    if (found[j] != 1)
+      fail ("\"%s\" listed %d times", names[j], found[j]);
+  msg ("listed each file once");
+
+  CHECK (getdents (dir_fd, ents, 2) == 0, "getdents at end returns 0");
+  close (dir_fd);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-normal) begin
+(getdents-normal) create "a.txt"
+(getdents-normal) create "b.txt"
+(getdents-normal) create "c.txt"
+(getdents-normal) open "/"
+(getdents-normal) listed each file once
+(getdents-normal) getdents at end returns 0
+(getdents-normal) end
+getdents-normal: exit(0)
+EOF
+pass;
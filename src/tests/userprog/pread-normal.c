@@ -0,0 +1,28 @@
+/* Reads two regions of a file with pread() and checks that the
+   file position is left untouched. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[64];
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  byte_cnt = pread (handle, buf, sizeof buf, 100);
+  if (byte_cnt != sizeof buf)
+    fail ("pread() returned %d instead of %zu", byte_cnt, sizeof buf);
+  compare_bytes (buf, sample + 100, sizeof buf, 100, "sample.txt");
+
+  byte_cnt = pread (handle, buf, sizeof buf, 0);
+  if (byte_cnt != sizeof buf)
+    fail ("pread() returned %d instead of %zu", byte_cnt, sizeof buf);
+  compare_bytes (buf, sample, sizeof buf, 0, "sample.txt");
+
+  CHECK (tell (handle) == 0, "file position unchanged");
+}
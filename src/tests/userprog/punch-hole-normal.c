@@ -0,0 +1,40 @@
+/* Writes a file that needs an indirect block, punches a hole in
+   the middle of it with punch_hole() that starts and ends partway
+   through a sector, and checks that the hole reads back as zeros
+   while the rest of the file and its size are unchanged. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[8192];
+
+void
+test_main (void) 
+{
+  int handle, byte_cnt;
+  size_t ofs;
+
+  for (ofs = 0; ofs < sizeof buf; ofs += sizeof sample - 1)
+    memcpy (buf + ofs, sample, ofs + sizeof sample - 1 <= sizeof buf
+                               ? sizeof sample - 1 : sizeof buf - ofs);
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+  byte_cnt = write (handle, buf, sizeof buf);
+  if (byte_cnt != sizeof buf)
+    fail ("write() returned %d instead of %zu", byte_cnt, sizeof buf);
+
+  CHECK (punch_hole (handle, 700, 3000) == 0,
+         "punch 3000 bytes at offset 700");
+  CHECK (filesize (handle) == sizeof buf, "filesize is %zu", sizeof buf);
+  CHECK (punch_hole (STDOUT_FILENO, 0, 100) == -1,
+         "punch stdout (must return -1)");
+  close (handle);
+
+  memset (buf + 700, 0, 3000);
+  check_file ("test.txt", buf, sizeof buf);
+}
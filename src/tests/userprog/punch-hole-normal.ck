@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(punch-hole-normal) begin
+(punch-hole-normal) create "test.txt"
+(punch-hole-normal) open "test.txt"
+(punch-hole-normal) punch 3000 bytes at offset 700
+(punch-hole-normal) filesize is 8192
+(punch-hole-normal) punch stdout (must return -1)
+(punch-hole-normal) open "test.txt" for verification
+(punch-hole-normal) verified contents of "test.txt"
+(punch-hole-normal) close "test.txt"
+(punch-hole-normal) end
+punch-hole-normal: exit(0)
+EOF
+pass;
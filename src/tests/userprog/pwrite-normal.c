@@ -0,0 +1,30 @@
+/* Writes a file back to front in two pwrite() calls, then
+   verifies its contents and that the file position did not
+   move. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  size_t size = sizeof sample - 1;
+  int handle, byte_cnt;
+
+  CHECK (create ("test.txt", size), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  byte_cnt = pwrite (handle, sample + 128, size - 128, 128);
+  if (byte_cnt != (int) (size - 128))
+    fail ("pwrite() returned %d instead of %zu", byte_cnt, size - 128);
+  byte_cnt = pwrite (handle, sample, 128, 0);
+  if (byte_cnt != 128)
+    fail ("pwrite() returned %d instead of 128", byte_cnt);
+
+  CHECK (tell (handle) == 0, "file position unchanged");
+  close (handle);
+
+  check_file ("test.txt", sample, size);
+}
@@ -0,0 +1,32 @@
+/* Reads a file into three separate buffers with a single
+   readv() call and verifies the result. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[sizeof sample];
+
+void
+test_main (void) 
+{
+  size_t size = sizeof sample - 1;
+  struct iovec iov[3];
+  int handle, byte_cnt;
+
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 1;
+  iov[1].iov_base = buf + 1;
+  iov[1].iov_len = 200;
+  iov[2].iov_base = buf + 201;
+  iov[2].iov_len = sizeof buf - 201;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  byte_cnt = readv (handle, iov, 3);
+  if (byte_cnt != (int) size)
+    fail ("readv() returned %d instead of %zu", byte_cnt, size);
+  compare_bytes (buf, sample, size, 0, "sample.txt");
+  msg ("verified contents of \"sample.txt\"");
+}
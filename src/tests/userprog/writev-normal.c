@@ -0,0 +1,32 @@
+/* Writes a file from three separate buffers with a single
+   writev() call, then reads it back to verify it. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  size_t size = sizeof sample - 1;
+  struct iovec iov[3];
+  int handle, byte_cnt;
+
+  iov[0].iov_base = sample;
+  iov[0].iov_len = 10;
+  iov[1].iov_base = sample + 10;
+  iov[1].iov_len = 100;
+  iov[2].iov_base = sample + 110;
+  iov[2].iov_len = size - 110;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  byte_cnt = writev (handle, iov, 3);
+  if (byte_cnt != (int) size)
+    fail ("writev() returned %d instead of %zu", byte_cnt, size);
+  close (handle);
+
+  check_file ("test.txt", sample, size);
+}
@@ -34,9 +34,11 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/page-cache.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -53,6 +55,20 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size in sectors of an empty RAM disk to create, or 0. */
+static block_sector_t ramdisk_sectors;
+
+/* -cache: Maximum buffer cache size in sectors, or 0 to size it
+   from the kernel pool. */
+static size_t cache_sectors;
+
+/* -pcache: Maximum page cache size in pages, or 0 to size it
+   from the kernel pool. */
+static size_t pcache_pages;
+
+/* -scratch-ram: Copy the scratch device into a RAM disk? */
+static bool scratch_in_ram;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -124,8 +140,11 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  if (ramdisk_sectors > 0)
+    ramdisk_create ("ram0", BLOCK_RAW, ramdisk_sectors);
   locate_block_devices ();
-  buffer_cache_init ();
+  buffer_cache_init (cache_sectors);
+  page_cache_init (pcache_pages);
   filesys_init (format_filesys);
 #endif
 
@@ -249,6 +268,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-scratch-ram"))
+        scratch_in_ram = true;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_sectors = atoi (value);
+      else if (!strcmp (name, "-cache"))
+        cache_sectors = atoi (value);
+      else if (!strcmp (name, "-pcache"))
+        pcache_pages = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -317,6 +344,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"archive", 1, fsutil_archive},
 #endif
       {NULL, 0, NULL},
     };
@@ -366,6 +394,7 @@ usage (void)
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
+          "  archive            Tar all files in root dir to scratch device.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -375,6 +404,10 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -scratch-ram       Read scratch from a copy in RAM.\n"
+          "  -ramdisk=SECTORS   Create empty RAM disk ram0 of SECTORS.\n"
+          "  -cache=SECTORS     Cache at most SECTORS (min. 128) metadata sectors.\n"
+          "  -pcache=PAGES      Cache at most PAGES pages of file data.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -398,6 +431,18 @@ locate_block_devices (void)
 #ifdef VM
   locate_block_device (BLOCK_SWAP, swap_bdev_name);
 #endif
+
+  if (scratch_in_ram && block_get_role (BLOCK_SCRATCH) != NULL)
+    {
+      struct block *ram = ramdisk_load ("ram1", BLOCK_SCRATCH,
+                                        block_get_role (BLOCK_SCRATCH));
+      if (ram != NULL)
+        {
+          printf ("%s: using %s\n", block_type_name (BLOCK_SCRATCH),
+                  block_name (ram));
+          block_set_role (BLOCK_SCRATCH, ram);
+        }
+    }
 }
 
 /* Figures out what block device to use for the given ROLE: the
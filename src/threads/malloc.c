@@ -6,7 +6,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -32,7 +34,18 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   To keep the common case off the descriptor locks, each thread
+   also holds a small "magazine" of free blocks per descriptor.
+   malloc() pops from the running thread's magazine and free()
+   pushes onto it, neither taking a lock.  Only when a magazine
+   runs empty (or overflows) do we take the descriptor lock, and
+   then we move MAGAZINE_BATCH blocks at once.  From the arena's
+   point of view a block sitting in a magazine is in use, so an
+   arena cannot be returned to the page allocator until the
+   magazines holding its blocks are drained, which happens at the
+   latest when the owning thread exits. */
 
 /* Descriptor. */
 struct desc
@@ -57,15 +70,28 @@ struct arena
 /* Free block. */
 struct block 
   {
-    struct list_elem free_elem; /* Free list element. */
+    union
+      {
+        struct list_elem free_elem; /* Free list element. */
+        struct block *next;         /* Next block in a magazine. */
+      };
   };
 
+/* Maximum number of blocks a thread caches per descriptor, and
+   the number moved to or from the descriptor at a time. */
+#define MAGAZINE_SIZE 8
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_CLASS_CNT]; /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static bool refill_magazine (struct desc *, struct malloc_magazine *);
+static void drain_magazine (struct desc *, struct malloc_magazine *,
+                            unsigned cnt);
+static void free_block (struct desc *, struct block *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -76,12 +102,26 @@ malloc_init (void)
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
       struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+      ASSERT (desc_cnt <= MALLOC_CLASS_CNT);
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
     }
+  ASSERT (desc_cnt == MALLOC_CLASS_CNT);
+}
+
+/* Returns every block cached by the running thread to its
+   descriptor.  Called by thread_exit() before the thread's
+   struct thread, which holds the magazines, goes away. */
+void
+malloc_thread_exit (void) 
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    drain_magazine (&descs[i], &t->magazines[i], t->magazines[i].cnt);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -90,6 +130,7 @@ void *
 malloc (size_t size) 
 {
   struct desc *d;
+  struct malloc_magazine *m;
   struct block *b;
   struct arena *a;
 
@@ -119,6 +160,29 @@ malloc (size_t size)
       return a + 1;
     }
 
+  /* Take a block from this thread's magazine, refilling it from
+     the descriptor first if it is empty. */
+  ASSERT (!intr_context ());
+  m = &thread_current ()->magazines[d - descs];
+  if (m->cnt == 0 && !refill_magazine (d, m))
+    return NULL;
+  b = m->head;
+  m->head = b->next;
+  m->cnt--;
+  return b;
+}
+
+/* Moves up to MAGAZINE_BATCH blocks from D's free list into
+   magazine M, which must be empty, creating a new arena if the
+   free list is empty.  Returns false if no memory is
+   available. */
+static bool
+refill_magazine (struct desc *d, struct malloc_magazine *m) 
+{
+  struct arena *a;
+
+  ASSERT (m->cnt == 0);
+
   lock_acquire (&d->lock);
 
   /* If the free list is empty, create a new arena. */
@@ -131,7 +195,7 @@ malloc (size_t size)
       if (a == NULL) 
         {
           lock_release (&d->lock);
-          return NULL; 
+          return false; 
         }
 
       /* Initialize arena and add its blocks to the free list. */
@@ -145,12 +209,39 @@ malloc (size_t size)
         }
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  /* Move a batch of blocks from the free list to the magazine. */
+  while (m->cnt < MAGAZINE_BATCH && !list_empty (&d->free_list))
+    {
+      struct block *b = list_entry (list_pop_front (&d->free_list),
+                                    struct block, free_elem);
+      a = block_to_arena (b);
+      a->free_cnt--;
+      b->next = m->head;
+      m->head = b;
+      m->cnt++;
+    }
+  lock_release (&d->lock);
+  return true;
+}
+
+/* Returns CNT blocks from magazine M to descriptor D. */
+static void
+drain_magazine (struct desc *d, struct malloc_magazine *m, unsigned cnt) 
+{
+  ASSERT (cnt <= m->cnt);
+
+  if (cnt == 0)
+    return;
+
+  lock_acquire (&d->lock);
+  while (cnt-- > 0) 
+    {
+      struct block *b = m->head;
+      m->head = b->next;
+      m->cnt--;
+      free_block (d, b);
+    }
   lock_release (&d->lock);
-  return b;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -227,32 +318,22 @@ free (void *p)
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct malloc_magazine *m;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
 
-          lock_release (&d->lock);
+          /* Push the block onto this thread's magazine, spilling
+             a batch back to the descriptor if it is full. */
+          ASSERT (!intr_context ());
+          m = &thread_current ()->magazines[d - descs];
+          if (m->cnt >= MAGAZINE_SIZE)
+            drain_magazine (d, m, MAGAZINE_BATCH);
+          b->next = m->head;
+          m->head = b;
+          m->cnt++;
         }
       else
         {
@@ -263,6 +344,34 @@ free (void *p)
     }
 }
 
+/* Adds block B to D's free list, returning its arena to the page
+   allocator if the arena is now entirely unused.  D's lock must
+   be held. */
+static void
+free_block (struct desc *d, struct block *b) 
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+    }
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -4,7 +4,19 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Number of malloc() size classes: 16, 32, ..., 1024 bytes. */
+#define MALLOC_CLASS_CNT 7
+
+/* Per-thread cache of free blocks of one size class, kept as a
+   singly linked list threaded through the blocks themselves. */
+struct malloc_magazine
+  {
+    void *head;                 /* First cached block. */
+    unsigned cnt;               /* Number of cached blocks. */
+  };
+
 void malloc_init (void);
+void malloc_thread_exit (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
@@ -7,8 +7,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <list.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,22 +24,63 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**ORDER pages,
+   each aligned (relative to the pool base) to its own size, on
+   one free list per order.  A request for PAGE_CNT pages takes
+   the smallest block of at least that size, splitting larger
+   blocks as needed, and hands the unused tail back.  Freeing a
+   range breaks it into aligned blocks and merges each with its
+   "buddy", the other half of the next larger block, for as long
+   as the buddy is also free.  Both operations are O(log n) in
+   the pool size.
+
+   Pages may be freed in pieces other than the ones in which they
+   were allocated; every freed range is decomposed the same way.
+
+   The pool is protected by disabling interrupts rather than by a
+   lock, because thread_schedule_tail() frees the page of a dying
+   thread from inside the scheduler, where it cannot block. */
+
+/* Largest block order.  A single request cannot exceed
+   2**MAX_ORDER pages. */
+#define MAX_ORDER 16
+
+/* Marks a page that is not the head of a free block. */
+#define NO_ORDER 0xff
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *orders;                    /* Order of each free block head. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks, by order. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    size_t free_cnt;                    /* Number of free pages. */
+  };
+
+/* Header at the start of each free block. */
+struct free_block
+  {
+    struct list_elem elem;              /* Element in a free list. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Called in turn to give back kernel pages when the kernel pool
+   is exhausted. */
+#define RECLAIM_MAX 4
+static palloc_reclaim_func *reclaimers[RECLAIM_MAX];
+static size_t reclaim_cnt;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -61,6 +103,126 @@ palloc_init (size_t user_page_limit)
              user_pages, "user pool");
 }
 
+/* Adds FUNC to the functions called to free up kernel pages
+   when an allocation from the kernel pool would fail.  Kernel
+   caches that can shrink, such as the buffer cache, register
+   themselves here. */
+void
+palloc_add_reclaim (palloc_reclaim_func *func) 
+{
+  ASSERT (reclaim_cnt < RECLAIM_MAX);
+  reclaimers[reclaim_cnt++] = func;
+}
+
+/* Asks each reclaim function in turn to free a kernel page.
+   Returns true as soon as one does. */
+static bool
+reclaim (void) 
+{
+  size_t i;
+
+  if (intr_context ())
+    return false;
+  for (i = 0; i < reclaim_cnt; i++)
+    if (reclaimers[i] ())
+      return true;
+  return false;
+}
+
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_free_pages (enum palloc_flags flags) 
+{
+  return (flags & PAL_USER ? &user_pool : &kernel_pool)->free_cnt;
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+order_for (size_t page_cnt) 
+{
+  int order = 0;
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Returns the free block of POOL at PAGE_IDX. */
+static struct free_block *
+idx_to_block (const struct pool *pool, size_t page_idx) 
+{
+  return (struct free_block *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the page index in POOL of free block B. */
+static size_t
+block_to_idx (const struct pool *pool, struct free_block *b) 
+{
+  return ((uint8_t *) b - pool->base) / PGSIZE;
+}
+
+/* Puts the block of 2**ORDER pages at PAGE_IDX on POOL's free
+   list for ORDER. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order) 
+{
+  list_push_front (&pool->free_lists[order],
+                   &idx_to_block (pool, page_idx)->elem);
+  pool->orders[page_idx] = order;
+}
+
+/* Takes the block at PAGE_IDX off POOL's free lists. */
+static void
+remove_block (struct pool *pool, size_t page_idx) 
+{
+  list_remove (&idx_to_block (pool, page_idx)->elem);
+  pool->orders[page_idx] = NO_ORDER;
+}
+
+/* Takes PAGE_CNT contiguous pages from POOL's free lists and
+   returns the first, or a null pointer if there is no free block
+   large enough. */
+static void *
+take_pages (struct pool *pool, size_t page_cnt) 
+{
+  enum intr_level old_level;
+  void *pages = NULL;
+  int order = order_for (page_cnt);
+  int o;
+
+  old_level = intr_disable ();
+  for (o = order; o <= MAX_ORDER; o++)
+    if (!list_empty (&pool->free_lists[o]))
+      {
+        struct list_elem *e = list_front (&pool->free_lists[o]);
+        size_t page_idx = block_to_idx (pool, list_entry (e, struct free_block,
+                                                          elem));
+        remove_block (pool, page_idx);
+
+        /* Split the block down to ORDER, freeing the upper
+           halves. */
+        while (o > order) 
+          {
+            o--;
+            push_block (pool, page_idx + ((size_t) 1 << o), o);
+          }
+
+        /* Give back the pages past PAGE_CNT. */
+        ASSERT (bitmap_none (pool->used_map, page_idx,
+                             (size_t) 1 << order));
+        bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+        free_range (pool, page_idx + page_cnt,
+                    ((size_t) 1 << order) - page_cnt);
+
+        pages = pool->base + PGSIZE * page_idx;
+        pool->free_cnt -= page_cnt;
+        break;
+      }
+  intr_set_level (old_level);
+
+  return pages;
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -72,19 +234,16 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  pages = take_pages (pool, page_cnt);
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  /* If the kernel pool is exhausted, have the kernel's caches
+     give back memory until the request fits or they run dry. */
+  while (pages == NULL && pool == &kernel_pool && reclaim ())
+    pages = take_pages (pool, page_cnt);
 
   if (pages != NULL) 
     {
@@ -118,6 +277,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -137,8 +297,12 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_range (pool, page_idx, page_cnt);
+  pool->free_cnt += page_cnt;
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +312,57 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to POOL's free
+   lists.  The range is split into the largest blocks that are
+   aligned to their own size, and each block is merged with its
+   buddy for as long as the buddy is free.  Interrupts must be
+   off. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (page_cnt > 0) 
+    {
+      size_t idx = page_idx;
+      int order = 0;
+
+      while (order < MAX_ORDER
+             && (idx & ((size_t) 1 << order)) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+
+      /* Coalesce with free buddies. */
+      while (order < MAX_ORDER) 
+        {
+          size_t buddy = idx ^ ((size_t) 1 << order);
+          if (buddy + ((size_t) 1 << order) > pool->page_cnt
+              || pool->orders[buddy] != order)
+            break;
+          remove_block (pool, buddy);
+          if (buddy < idx)
+            idx = buddy;
+          order++;
+        }
+      push_block (pool, idx, order);
+    }
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and block orders at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  enum intr_level old_level;
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -164,9 +370,18 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->orders = (uint8_t *) base + bm_size;
+  memset (p->orders, NO_ORDER, page_cnt);
+  for (order = 0; order <= MAX_ORDER; order++)
+    list_init (&p->free_lists[order]);
   p->base = base + bm_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->free_cnt = page_cnt;
+
+  old_level = intr_disable ();
+  free_range (p, 0, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +391,7 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
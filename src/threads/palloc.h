@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,7 +12,14 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Called when the kernel pool runs out of pages.  Should free at
+   least one kernel page and return true, or return false if it
+   cannot. */
+typedef bool palloc_reclaim_func (void);
+
 void palloc_init (size_t user_page_limit);
+void palloc_add_reclaim (palloc_reclaim_func *);
+size_t palloc_free_pages (enum palloc_flags);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
@@ -0,0 +1,232 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator.
+
+   malloc() rounds each request up to a power of 2, so an object
+   just over a power of 2 in size wastes almost half of its
+   block, and all objects of similar size share one free list.
+   A cache instead divides pages into objects of exactly the size
+   it was created for (plus a link pointer), and keeps its own
+   lock and free lists.
+
+   Each slab is one page, which starts with a struct slab header
+   followed by the objects.  Free objects in a slab are chained
+   through a pointer stored just past the end of each object, so
+   that freeing an object does not disturb its constructed
+   state.  A cache keeps its slabs on three lists, by whether
+   they are full, partly used, or empty; at most one empty slab
+   is kept around, and further empty slabs are returned to the
+   page allocator. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Maximum number of caches. */
+#define KMEM_CACHE_MAX 16
+
+/* A cache. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t size;                /* Object size in bytes. */
+    size_t stride;              /* Object size plus link, aligned. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct lock lock;           /* Protects the members below. */
+
+    struct list full;           /* Slabs with no free objects. */
+    struct list partial;        /* Slabs with some free objects. */
+    struct list empty;          /* Slabs with no objects in use. */
+
+    /* Statistics. */
+    unsigned long long alloc_cnt;       /* Allocations. */
+    unsigned long long free_cnt;        /* Frees. */
+    size_t slab_cnt;                    /* Slabs now held. */
+    size_t in_use;                      /* Objects now allocated. */
+    size_t peak_in_use;                 /* Largest IN_USE. */
+  };
+
+/* A slab, at the start of its page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of CACHE's lists. */
+    size_t in_use;              /* Objects allocated from this slab. */
+    void *free;                 /* First free object, or null. */
+  };
+
+static struct kmem_cache caches[KMEM_CACHE_MAX];
+static size_t cache_cnt;
+
+/* Returns the location of the free-list link for OBJ in cache C. */
+static void **
+obj_link (struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->stride - sizeof (void *));
+}
+
+/* Creates and returns a cache named NAME for objects of SIZE
+   bytes.  If CTOR is non-null, it is called on each object when
+   its slab is created.  Caches are never destroyed. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+
+  ASSERT (size > 0);
+  if (cache_cnt >= KMEM_CACHE_MAX)
+    PANIC ("too many object caches");
+
+  c = &caches[cache_cnt++];
+  c->name = name;
+  c->size = size;
+  c->stride = ROUND_UP (size, sizeof (void *)) + sizeof (void *);
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / c->stride;
+  ASSERT (c->objs_per_slab > 0);
+  c->ctor = ctor;
+  lock_init (&c->lock);
+  list_init (&c->full);
+  list_init (&c->partial);
+  list_init (&c->empty);
+  c->alloc_cnt = c->free_cnt = 0;
+  c->slab_cnt = c->in_use = c->peak_in_use = 0;
+  return c;
+}
+
+/* Allocates a new slab for cache C, constructs its objects, and
+   adds it to C's empty list.  Returns false if no page is
+   available. */
+static bool
+slab_grow (struct kmem_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  uint8_t *obj;
+  size_t i;
+
+  if (s == NULL)
+    return false;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+  obj = (uint8_t *) (s + 1) + (c->objs_per_slab - 1) * c->stride;
+  for (i = 0; i < c->objs_per_slab; i++, obj -= c->stride)
+    {
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+  list_push_front (&c->empty, &s->elem);
+  c->slab_cnt++;
+  return true;
+}
+
+/* Returns an object from cache C, or a null pointer if memory
+   is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* Prefer partly used slabs, to keep empty ones free. */
+  if (list_empty (&c->partial) && list_empty (&c->empty)
+      && !slab_grow (c))
+    {
+      lock_release (&c->lock);
+      return NULL;
+    }
+  s = list_entry (list_front (!list_empty (&c->partial)
+                              ? &c->partial : &c->empty),
+                  struct slab, elem);
+
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  if (s->in_use++ == 0 || s->free == NULL)
+    {
+      list_remove (&s->elem);
+      list_push_front (s->free == NULL ? &c->full : &c->partial, &s->elem);
+    }
+
+  c->alloc_cnt++;
+  if (++c->in_use > c->peak_in_use)
+    c->peak_in_use = c->in_use;
+
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C.  Ignores a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT (((uint8_t *) obj - (uint8_t *) (s + 1)) % c->stride == 0);
+
+  lock_acquire (&c->lock);
+
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  c->free_cnt++;
+  c->in_use--;
+
+  if (--s->in_use == 0)
+    {
+      /* Slab is now empty.  Keep one empty slab for the next
+         allocation and give any others back. */
+      list_remove (&s->elem);
+      if (list_empty (&c->empty))
+        list_push_front (&c->empty, &s->elem);
+      else
+        {
+          c->slab_cnt--;
+          palloc_free_page (s);
+        }
+    }
+  else if (s->in_use == c->objs_per_slab - 1)
+    {
+      /* Slab was full. */
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each cache. */
+void
+kmem_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+      printf ("Slab %s: %zu-byte objects, %zu in use (peak %zu), "
+              "%llu allocs, %llu frees, %zu slabs\n",
+              c->name, c->size, c->in_use, c->peak_in_use,
+              c->alloc_cnt, c->free_cnt, c->slab_cnt);
+    }
+}
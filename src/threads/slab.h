@@ -0,0 +1,24 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Object caches.
+
+   A cache hands out objects of a single, exact size, carved out
+   of pages ("slabs") obtained from the page allocator. */
+struct kmem_cache;
+
+/* Constructor, called on each object when the slab holding it
+   is created.  Objects are expected to be back in their
+   constructed state when they are freed, so the constructor
+   runs once per object rather than once per allocation. */
+typedef void kmem_ctor_func (void *object);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
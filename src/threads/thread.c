@@ -8,6 +8,7 @@
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -31,6 +32,9 @@ static struct list all_list;
 /* Idle thread. */
 static struct thread *idle_thread;
 
+/* Cache for struct child. */
+static struct kmem_cache *child_cache;
+
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
@@ -111,6 +115,8 @@ thread_init (void)
 void
 thread_start (void) 
 {
+  child_cache = kmem_cache_create ("child", sizeof (struct child), NULL);
+
   /* Create the idle thread. */
   struct semaphore idle_started;
   sema_init (&idle_started, 0);
@@ -188,7 +194,7 @@ thread_create (const char *name, int priority,
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
-  struct child* new_child= malloc (sizeof (struct child));
+  struct child* new_child= kmem_cache_alloc (child_cache);
   new_child->tid=tid;
   new_child->exit_status=t->exit_status;
   new_child->used=false;
@@ -301,18 +307,12 @@ thread_exit (void)
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
 
-  if (!list_empty (&thread_current ()->child_list))
+  while (!list_empty (&thread_current ()->child_list))
     {
-      struct list_elem *e;
-      for(e = list_begin (&thread_current ()->child_list); \
-          e != list_end (&thread_current ()->child_list);e = list_next(e))
-        {
-          struct child *t = list_entry (e, struct child, child_elem);
-          free (t);
-          t=NULL;
-        }
+      struct list_elem *e = list_pop_front (&thread_current ()->child_list);
+      kmem_cache_free (child_cache, list_entry (e, struct child, child_elem));
     }
-
+  malloc_thread_exit ();
 
   
   intr_disable ();
@@ -523,7 +523,9 @@ init_thread (struct thread *t, const char *name, int priority)
   t->magic = THREAD_MAGIC;
   
   /* Project 2 init*/
-  t->fd = 2;
+  t->fd_table = NULL;
+  t->fd_cnt = 0;
+  t->fd_min_free = 2;
   t->parent =running_thread ();
   t->exit_status=-200;
   sema_init (&t->child_lock,0);
@@ -531,7 +533,6 @@ init_thread (struct thread *t, const char *name, int priority)
   t->self=NULL;
   t->cwd = NULL;
 
-  list_init (&(t->file_descriptors));
   list_init (&(t->child_list));
 
   old_level = intr_disable ();
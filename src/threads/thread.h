@@ -5,13 +5,13 @@
 #include <list.h>
 #include <stdint.h>
 #include <threads/synch.h>
+#include <threads/malloc.h>
 
 typedef int pid;
 
 /* State to descripe a file in a thread */
 struct file_descriptor
 {
-  struct list_elem file_elem;
   struct file * file_address;
   struct dir * dir;
   int fd;
@@ -112,8 +112,9 @@ struct thread
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
 
-    int fd;                             /* file descriptor id. */
-    struct list file_descriptors;       /* File descriptors. */
+    struct file_descriptor **fd_table;  /* Open files, indexed by fd. */
+    int fd_cnt;                         /* Number of slots in fd_table. */
+    int fd_min_free;                    /* No fd below this is free. */
     struct file *self;                  /* The process itself */
 
     struct thread *parent;       /* The thread waited for the thread */
@@ -126,6 +127,11 @@ struct thread
 
     /**************project 4************************/
     struct dir *cwd;
+    int journal_depth;                  /* Nested journal_begin() calls. */
+
+    /* Owned by threads/malloc.c. */
+    struct malloc_magazine magazines[MALLOC_CLASS_CNT];
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
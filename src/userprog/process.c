@@ -179,6 +179,8 @@ process_exit (void)
   printf ("%s: exit(%d)\n", cur->name, cur->exit_status);
 
 
+  syscall_close_all ();
+
   thread_lock_file ();
   file_allow_write (cur->self);
   file_close (cur->self);
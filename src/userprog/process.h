@@ -1,8 +1,12 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <dirent.h>
+#include <uio.h>
 #include "threads/thread.h"
 
+struct intr_frame;
+
 void process_activate (void);
 
 void syscall_halt ();
@@ -15,17 +19,31 @@ int syscall_open (const char *file);
 int syscall_filesize (int fd);
 int syscall_read (int fd, void *buffer, unsigned size);
 int syscall_write (int fd, const void *buffer, unsigned size);
+int syscall_readv (int fd, const struct iovec *iov, int iovcnt);
+int syscall_writev (int fd, const struct iovec *iov, int iovcnt);
+int syscall_pread (int fd, void *buffer, unsigned size, unsigned offset);
+int syscall_pwrite (int fd, const void *buffer, unsigned size,
+                    unsigned offset);
+int syscall_fsync (int fd);
+void syscall_sync (void);
 void syscall_seek (int fd, unsigned position);
 unsigned syscall_tell (int fd);
-void close (int fd);
+void syscall_close (int fd);
+void syscall_close_all (void);
 bool syscall_mkdir (const char *);
 bool syscall_chdir (const char *);
 bool syscall_readdir (int, char *);
+int syscall_getdents (int fd, struct dirent *, int cnt);
+int syscall_fallocate (int fd, unsigned length);
+int syscall_ftruncate (int fd, unsigned length);
+int syscall_punch_hole (int fd, unsigned offset, unsigned length);
 int syscall_inumber (int);
 bool syscall_isdir(int);
 
 
-void syscall_check_addr (void *ptr, struct intr_frame *f UNUSED);
-void syscall_check_buffer (void *ptr, struct intr_frame *f UNUSED, unsigned size);
+bool copy_from_user (void *dst, const void *usrc, size_t size);
+void syscall_check_buffer (const void *ptr, struct intr_frame *f UNUSED,
+                           unsigned size, bool write);
+void syscall_check_string (const char *str, struct intr_frame *f UNUSED);
 
 #endif /* userprog/process.h */
@@ -1,8 +1,13 @@
 #include "userprog/syscall.h"
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <uio.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "devices/shutdown.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
@@ -12,28 +17,54 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 
-#define ARGC_MAX 3
+#define ARGC_MAX 4
 typedef tid_t pid_t;
 
+/* Lowest file descriptor handed out by open; 0 and 1 are the
+   console. */
+#define FD_MIN 2
+/* Slots in a process's descriptor table when it is first grown. */
+#define FD_TABLE_INIT 16
+
 static void syscall_handler (struct intr_frame *);
+static void syscall_get_args (struct intr_frame *, int *args, int argc);
+static struct iovec *syscall_copy_iov (const struct iovec *uiov, int iovcnt,
+                                       bool write, struct intr_frame *);
+static bool user_range_ok (const void *uaddr, size_t size, bool write);
+static bool user_string_ok (const char *ustr);
+static struct file_descriptor *fd_lookup (int fd);
+static int fd_install (struct file_descriptor *);
+static void fd_remove (int fd);
+static void fd_release (struct file_descriptor *);
 struct lock filesys_lock;
 
+/* Cache for struct file_descriptor. */
+static struct kmem_cache *fd_cache;
+
 void
 syscall_init (void) 
 {
   lock_init (&filesys_lock);
+  fd_cache = kmem_cache_create ("file_descriptor",
+                                sizeof (struct file_descriptor), NULL);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
-  void *stack_p = f->esp;
-  syscall_check_buffer (stack_p, f, 4);
+  int args[ARGC_MAX];
+  int number;
+
+  if (!copy_from_user (&number, f->esp, sizeof number))
+    {
+      f->eax = -1;
+      syscall_exit (-1);
+    }
 
-  // printf ("the syscall is %d\n", *((int *)stack_p));
+  // printf ("the syscall is %d\n", number);
 
-  switch (*((int *)stack_p))
+  switch (number)
   {
     case SYS_HALT:
       {
@@ -42,20 +73,20 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_EXIT:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
 
-        int status = *((int *)f->esp + 1);
+        int status = args[0];
 
         syscall_exit (status);
         break;
       }
     case SYS_EXEC:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
 
-        const char *cmd_line = (const char *)*((int *)f->esp + 1);
+        const char *cmd_line = (const char *) args[0];
 
-        syscall_check_buffer ((void *)cmd_line, f, 4);
+        syscall_check_string (cmd_line, f);
 
         f->eax = syscall_exec (cmd_line);
 
@@ -63,10 +94,9 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_WAIT:
       {
-        /* Check stack validation */
-        syscall_check_buffer (stack_p, f, 8);
         /* Get args */
-        pid_t pid = *((int *)f->esp + 1);
+        syscall_get_args (f, args, 1);
+        pid_t pid = args[0];
         //printf ("PID: %d\n", pid);
         /* Call function and return value */
         f->eax = syscall_wait (pid);
@@ -75,61 +105,45 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_CREATE:
       { 
-        syscall_check_buffer (stack_p, f, 12);
+        syscall_get_args (f, args, 2);
 
-        void *file = (void *)*((int *)f->esp + 1);
-        unsigned initial_size = *(unsigned *)((int *)f->esp + 2);
-        
-        void * phys_addr = pagedir_get_page (thread_current ()->pagedir, (const void *)file);
-        if (phys_addr == NULL)
-          {
-            f->eax = -1;
-            syscall_exit (-1);
-          }
+        const char *file = (const char *) args[0];
+        unsigned initial_size = (unsigned) args[1];
+
+        syscall_check_string (file, f);
 
-        f->eax = syscall_create (phys_addr, initial_size);
+        f->eax = syscall_create (file, initial_size);
 
         break;
       }
     case SYS_REMOVE:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
 
-        void *file = (void *)*((int *)f->esp + 1);
+        const char *file = (const char *) args[0];
         /* Check the validatioin of system file */
-        void * phys_addr = pagedir_get_page (thread_current ()->pagedir, (const void *)file);
-        if (phys_addr == NULL)
-          {
-            f->eax = -1;
-            syscall_exit (-1);
-          }
+        syscall_check_string (file, f);
 
-        f->eax = syscall_remove (phys_addr);
+        f->eax = syscall_remove (file);
         break;
       }
     case SYS_OPEN:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
 
-        void *file = (void *)*((int *)f->esp + 1);
+        const char *file = (const char *) args[0];
 
-        void * phys_addr = pagedir_get_page (thread_current ()->pagedir, (const void *)file);
-        if (phys_addr == NULL)
-          {
-            f->eax = -1;
-            syscall_exit (-1);
-          }
+        syscall_check_string (file, f);
 
-        f->eax = syscall_open (phys_addr);
+        f->eax = syscall_open (file);
 
         break;
       }
     case SYS_FILESIZE:
       {
+        syscall_get_args (f, args, 1);
 
-        syscall_check_buffer (stack_p, f, 8);
-
-        int fd = *((int *)f->esp + 1);
+        int fd = args[0];
 
         f->eax = syscall_filesize (fd);
 
@@ -137,14 +151,14 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_READ:
       {
-        
-        syscall_check_buffer (stack_p, f, 16);
+        syscall_get_args (f, args, 3);
 
-        int fd = *((int *)f->esp + 1);
-        void *buffer = (void *)*((int *)f->esp + 2);
-        unsigned size = *((unsigned *)f->esp + 3);
+        int fd = args[0];
+        void *buffer = (void *) args[1];
+        unsigned size = (unsigned) args[2];
 
-        syscall_check_buffer (buffer, f, size);
+        /* The kernel stores into BUFFER, so it must be writable. */
+        syscall_check_buffer (buffer, f, size, true);
 
         f->eax = syscall_read (fd, buffer, size);
 
@@ -152,13 +166,13 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_WRITE:
       {
-        syscall_check_buffer (stack_p, f, 16);
+        syscall_get_args (f, args, 3);
 
-        int fd = *((int *)f->esp + 1);
-        void *buffer = (void *)(*((int *)f->esp + 2));
-        unsigned size = *((unsigned *)f->esp + 3);
+        int fd = args[0];
+        const void *buffer = (const void *) args[1];
+        unsigned size = (unsigned) args[2];
 
-        syscall_check_buffer (buffer, f, size);
+        syscall_check_buffer (buffer, f, size, false);
 
         int ret = syscall_write (fd, buffer, size);
       
@@ -168,10 +182,10 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_SEEK:
       {
-        syscall_check_buffer (stack_p, f, 12);
+        syscall_get_args (f, args, 2);
 
-        int fd = *((int *)f->esp + 1);
-        unsigned position = *((unsigned *)f->esp + 2);
+        int fd = args[0];
+        unsigned position = (unsigned) args[1];
 
         syscall_seek (fd, position);
 
@@ -179,9 +193,9 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_TELL:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
         
-        int fd = *((int *)f->esp + 1);
+        int fd = args[0];
 
         f->eax = syscall_tell (fd);
         
@@ -189,9 +203,9 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_CLOSE:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
 
-        int fd = *((int *)f->esp + 1);
+        int fd = args[0];
 
         syscall_close (fd);
 
@@ -200,9 +214,11 @@ syscall_handler (struct intr_frame *f UNUSED)
 
     case SYS_CHDIR:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
         
-        const char * dir = *((int *)f->esp + 1);
+        const char *dir = (const char *) args[0];
+
+        syscall_check_string (dir, f);
 
         f->eax = syscall_chdir (dir);
         
@@ -211,9 +227,11 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_MKDIR:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
         
-        const char * dir = *((int *)f->esp + 1);
+        const char *dir = (const char *) args[0];
+
+        syscall_check_string (dir, f);
 
         f->eax = syscall_mkdir (dir);
         
@@ -222,10 +240,12 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_READDIR:
       {
         // filesys_remove("fs.tar");
-        syscall_check_buffer (stack_p, f, 12);
+        syscall_get_args (f, args, 2);
         
-        int fd = *((int *)f->esp + 1);
-        char *name = *((int *)f->esp + 2);
+        int fd = args[0];
+        char *name = (char *) args[1];
+
+        syscall_check_buffer (name, f, NAME_MAX + 1, true);
 
         f->eax = syscall_readdir (fd,name);
         
@@ -233,9 +253,9 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_INUMBER:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
         
-        int fd = *((int *)f->esp + 1);
+        int fd = args[0];
 
         f->eax = syscall_inumber (fd);
         
@@ -243,12 +263,173 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
     case SYS_ISDIR:
       {
-        syscall_check_buffer (stack_p, f, 8);
+        syscall_get_args (f, args, 1);
         
-        int fd = *((int *)f->esp + 1);
+        int fd = args[0];
 
         f->eax = syscall_isdir (fd);
         
+        break;
+      }
+    case SYS_READV:
+      {
+        syscall_get_args (f, args, 3);
+
+        int fd = args[0];
+        const struct iovec *uiov = (const struct iovec *) args[1];
+        int iovcnt = args[2];
+
+        if (iovcnt < 0 || iovcnt > IOV_MAX)
+          {
+            f->eax = -1;
+            break;
+          }
+        if (iovcnt == 0)
+          {
+            f->eax = 0;
+            break;
+          }
+
+        struct iovec *iov = syscall_copy_iov (uiov, iovcnt, true, f);
+        if (iov == NULL)
+          {
+            f->eax = -1;
+            break;
+          }
+
+        f->eax = syscall_readv (fd, iov, iovcnt);
+        free (iov);
+
+        break;
+      }
+    case SYS_WRITEV:
+      {
+        syscall_get_args (f, args, 3);
+
+        int fd = args[0];
+        const struct iovec *uiov = (const struct iovec *) args[1];
+        int iovcnt = args[2];
+
+        if (iovcnt < 0 || iovcnt > IOV_MAX)
+          {
+            f->eax = -1;
+            break;
+          }
+        if (iovcnt == 0)
+          {
+            f->eax = 0;
+            break;
+          }
+
+        struct iovec *iov = syscall_copy_iov (uiov, iovcnt, false, f);
+        if (iov == NULL)
+          {
+            f->eax = -1;
+            break;
+          }
+
+        f->eax = syscall_writev (fd, iov, iovcnt);
+        free (iov);
+
+        break;
+      }
+    case SYS_PREAD:
+      {
+        syscall_get_args (f, args, 4);
+
+        int fd = args[0];
+        void *buffer = (void *) args[1];
+        unsigned size = (unsigned) args[2];
+        unsigned offset = (unsigned) args[3];
+
+        syscall_check_buffer (buffer, f, size, true);
+
+        f->eax = syscall_pread (fd, buffer, size, offset);
+
+        break;
+      }
+    case SYS_PWRITE:
+      {
+        syscall_get_args (f, args, 4);
+
+        int fd = args[0];
+        const void *buffer = (const void *) args[1];
+        unsigned size = (unsigned) args[2];
+        unsigned offset = (unsigned) args[3];
+
+        syscall_check_buffer (buffer, f, size, false);
+
+        f->eax = syscall_pwrite (fd, buffer, size, offset);
+
+        break;
+      }
+    case SYS_FSYNC:
+      {
+        syscall_get_args (f, args, 1);
+
+        int fd = args[0];
+
+        f->eax = syscall_fsync (fd);
+
+        break;
+      }
+    case SYS_SYNC:
+      {
+        syscall_sync ();
+        break;
+      }
+    case SYS_GETDENTS:
+      {
+        syscall_get_args (f, args, 3);
+
+        int fd = args[0];
+        struct dirent *ents = (struct dirent *) args[1];
+        int cnt = args[2];
+
+        if (cnt < 0 || (unsigned) cnt > UINT_MAX / sizeof *ents)
+          {
+            f->eax = -1;
+            break;
+          }
+
+        syscall_check_buffer (ents, f, cnt * sizeof *ents, true);
+
+        f->eax = syscall_getdents (fd, ents, cnt);
+
+        break;
+      }
+    case SYS_FALLOCATE:
+      {
+        syscall_get_args (f, args, 2);
+
+        int fd = args[0];
+        unsigned length = (unsigned) args[1];
+
+        f->eax = syscall_fallocate (fd, length);
+
+        break;
+      }
+    case SYS_FTRUNCATE:
+      {
+        syscall_get_args (f, args, 2);
+
+        int fd = args[0];
+        unsigned length = (unsigned) args[1];
+
+        f->eax = syscall_ftruncate (fd, length);
+
+        break;
+      }
+    case SYS_PUNCH_HOLE:
+      {
+        syscall_get_args (f, args, 3);
+
+        int fd = args[0];
+        unsigned offset = (unsigned) args[1];
+        unsigned length = (unsigned) args[2];
+
+        f->eax = syscall_punch_hole (fd, offset, length);
+
         break;
       }
 
@@ -256,6 +437,51 @@ syscall_handler (struct intr_frame *f UNUSED)
       syscall_exit (-1);
   }
 }
+
+/* Copies the ARGC word-sized arguments that follow the system
+   call number on the user stack into ARGS.  Kills the process if
+   any of them lies outside its mapped memory. */
+static void
+syscall_get_args (struct intr_frame *f, int *args, int argc)
+{
+  ASSERT (argc <= ARGC_MAX);
+  if (!copy_from_user (args, (int *) f->esp + 1, argc * sizeof *args))
+    {
+      f->eax = -1;
+      syscall_exit (-1);
+    }
+}
+
+/* Copies the IOVCNT-entry iovec array at user address UIOV into
+   a newly allocated kernel array and checks every buffer it
+   names, requiring them to be writable if WRITE is true.  Kills
+   the process on a bad pointer.  Returns a null pointer if memory
+   is exhausted; otherwise the caller must free the array. */
+static struct iovec *
+syscall_copy_iov (const struct iovec *uiov, int iovcnt, bool write,
+                  struct intr_frame *f)
+{
+  struct iovec *iov = malloc (iovcnt * sizeof *iov);
+  int i;
+
+  if (iov == NULL)
+    return NULL;
+  if (!copy_from_user (iov, uiov, iovcnt * sizeof *iov))
+    {
+      free (iov);
+      f->eax = -1;
+      syscall_exit (-1);
+    }
+  for (i = 0; i < iovcnt; i++)
+    if (!user_range_ok (iov[i].iov_base, iov[i].iov_len, write))
+      {
+        free (iov);
+        f->eax = -1;
+        syscall_exit (-1);
+      }
+  return iov;
+}
+
 /* System call halt*/
 void
 syscall_halt (void)
@@ -307,31 +533,59 @@ syscall_write (int fd, const void *buffer, unsigned size)
       thread_release_file ();
       return size;
     }
-  if (list_empty (&(thread_current ()->file_descriptors)) || fd == 0)
+
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
     {
       return -1;
     }
+  if (inode_is_dir (file_get_inode (f->file_address)))
+    {
+      return -1;
+    }
+  thread_lock_file ();
+  int ret = file_write (f->file_address, buffer, size);
+  thread_release_file ();
+  return ret;
+}
 
-  struct list_elem *e;
+/* System call writev.  Writes the IOVCNT buffers in IOV to FD
+   in order, taking the file system lock once for all of them.
+   Stops at the first short write.  Returns the total number of
+   bytes written, or -1 if FD cannot be written. */
+int
+syscall_writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  struct file_descriptor *f = NULL;
+  int total = 0;
+  int i;
 
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
+  if (fd != 1)
     {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-      if (f->fd == fd)
+      f = fd_lookup (fd);
+      if (f == NULL || inode_is_dir (file_get_inode (f->file_address)))
         {
-          if (inode_is_dir (file_get_inode (f->file_address)))
-            {
-              return -1;
-            }
-          thread_lock_file ();
-          int ret = file_write (f->file_address, buffer, size);
-          thread_release_file ();
-          return ret;
+          return -1;
         }
     }
-  return -1;
+
+  thread_lock_file ();
+  for (i = 0; i < iovcnt; i++)
+    {
+      if (f == NULL)
+        {
+          putbuf (iov[i].iov_base, iov[i].iov_len);
+          total += iov[i].iov_len;
+          continue;
+        }
+      int ret = file_write (f->file_address, iov[i].iov_base,
+                            iov[i].iov_len);
+      total += ret;
+      if (ret != (int) iov[i].iov_len)
+        break;
+    }
+  thread_release_file ();
+  return total;
 }
 
 /* System call wait*/
@@ -372,16 +626,27 @@ syscall_open (const char *file)
       return -1;
     }
   
-  struct file_descriptor *file_des = malloc(sizeof(struct file_descriptor));
+  struct file_descriptor *file_des = kmem_cache_alloc (fd_cache);
+  if (file_des == NULL)
+    {
+      thread_lock_file ();
+      file_close (file_opened);
+      thread_release_file ();
+      return -1;
+    }
   file_des->file_address = file_opened;
-  file_des->fd = thread_current ()->fd++;
+  file_des->dir = NULL;
 
   if (file_get_inode (file_opened) != NULL && inode_is_dir (file_get_inode (file_opened)))
     {
       file_des->dir = dir_open (inode_reopen (file_get_inode (file_opened)));
     }
 
-  list_push_back (&(thread_current ()->file_descriptors), &(file_des->file_elem));
+  if (fd_install (file_des) < 0)
+    {
+      fd_release (file_des);
+      return -1;
+    }
 
   return file_des->fd;
 }
@@ -390,25 +655,13 @@ syscall_open (const char *file)
 int
 syscall_filesize (int fd)
 {
-  if (list_empty (&(thread_current ()->file_descriptors)))
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
     {
       return -1;
     }
-
-  struct list_elem *e;
-
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
-    {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-      if (f->fd == fd)
-        {
-          int ret = file_length (f->file_address);
-          return ret;
-        }
-    }
-  return -1;
+  int ret = file_length (f->file_address);
+  return ret;
 }
 
 /* System call read */
@@ -421,7 +674,7 @@ syscall_read (int fd, void *buffer, unsigned size)
     }
   if (fd == 0)
     {
-      for (int i = 0;i<size;i++)
+      for (unsigned i = 0;i<size;i++)
         {
           //thread_lock_file ();
           ((int8_t *)buffer)[i] = input_getc ();
@@ -429,140 +682,421 @@ syscall_read (int fd, void *buffer, unsigned size)
         }
       return size;
     }
-  if (list_empty (&(thread_current ()->file_descriptors)))
+
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
     {
       return -1;
     }
+  thread_lock_file ();
+  int ret = file_read (f->file_address, buffer, size);
+  thread_release_file ();
+  return ret;
+}
 
-  struct list_elem *e;
+/* System call readv.  Fills the IOVCNT buffers in IOV from FD
+   in order, taking the file system lock once for all of them.
+   Stops early at end of file.  Returns the total number of bytes
+   read, or -1 if FD cannot be read. */
+int
+syscall_readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  struct file_descriptor *f;
+  int total = 0;
+  int i;
 
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
+  if (fd == 1)
     {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-      if (f->fd == fd)
+      return -1;
+    }
+  if (fd == 0)
+    {
+      for (i = 0; i < iovcnt; i++)
         {
-          thread_lock_file ();
-          int ret = file_read (f->file_address, buffer, size);
-          thread_release_file ();
-          return ret;
+          total += syscall_read (0, iov[i].iov_base, iov[i].iov_len);
         }
+      return total;
     }
-  return -1;
+
+  f = fd_lookup (fd);
+  if (f == NULL)
+    {
+      return -1;
+    }
+
+  thread_lock_file ();
+  for (i = 0; i < iovcnt; i++)
+    {
+      int ret = file_read (f->file_address, iov[i].iov_base,
+                           iov[i].iov_len);
+      total += ret;
+      if (ret != (int) iov[i].iov_len)
+        break;
+    }
+  thread_release_file ();
+  return total;
+}
+
+/* System call pread.  Reads SIZE bytes from FD starting at byte
+   OFFSET, without using or moving the file's current position.
+   Returns the number of bytes read, or -1 if FD cannot be read
+   at that offset. */
+int
+syscall_pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL || (off_t) offset < 0)
+    {
+      return -1;
+    }
+  thread_lock_file ();
+  int ret = file_read_at (f->file_address, buffer, size, offset);
+  thread_release_file ();
+  return ret;
+}
+
+/* System call pwrite.  Writes SIZE bytes to FD starting at byte
+   OFFSET, without using or moving the file's current position.
+   Returns the number of bytes written, or -1 if FD cannot be
+   written at that offset. */
+int
+syscall_pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL || (off_t) offset < 0)
+    {
+      return -1;
+    }
+  if (inode_is_dir (file_get_inode (f->file_address)))
+    {
+      return -1;
+    }
+  thread_lock_file ();
+  int ret = file_write_at (f->file_address, buffer, size, offset);
+  thread_release_file ();
+  return ret;
+}
+
+/* System call fsync.  Writes FD's dirty blocks to disk without
+   touching other files' cached data.  Returns 0 on success, -1
+   if FD is not an open file. */
+int
+syscall_fsync (int fd)
+{
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
+    {
+      return -1;
+    }
+  thread_lock_file ();
+  file_flush (f->file_address);
+  thread_release_file ();
+  return 0;
+}
+
+/* Returns the open regular file FD, or a null pointer if FD is
+   not one. */
+static struct file *
+regular_file (int fd)
+{
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL || inode_is_dir (file_get_inode (f->file_address)))
+    {
+      return NULL;
+    }
+  return f->file_address;
+}
+
+/* System call fallocate.  Allocates disk space for the first
+   LENGTH bytes of FD, as one contiguous run if possible, and
+   extends FD to LENGTH bytes if it is shorter.  Returns 0 on
+   success, -1 if FD is not an open file or the space cannot be
+   allocated. */
+int
+syscall_fallocate (int fd, unsigned length)
+{
+  struct file *file = regular_file (fd);
+  if (file == NULL || (off_t) length < 0)
+    {
+      return -1;
+    }
+  thread_lock_file ();
+  bool success = file_allocate (file, length);
+  thread_release_file ();
+  return success ? 0 : -1;
+}
+
+/* System call ftruncate.  Sets FD's length to LENGTH bytes,
+   freeing the blocks past the new end or leaving a hole.
+   Returns 0 on success, -1 if FD is not an open file or cannot be
+   resized, as when LENGTH is over the largest file size. */
+int
+syscall_ftruncate (int fd, unsigned length)
+{
+  struct file *file = regular_file (fd);
+  if (file == NULL || (off_t) length < 0)
+    {
+      return -1;
+    }
+  thread_lock_file ();
+  bool success = file_truncate (file, length);
+  thread_release_file ();
+  return success ? 0 : -1;
+}
+
+/* System call punch_hole.  Frees the disk space behind the
+   LENGTH bytes of FD starting at OFFSET, which then read as
+   zeros; FD's length does not change.  Returns 0 on success, -1
+   if FD is not an open file or cannot be written. */
+int
+syscall_punch_hole (int fd, unsigned offset, unsigned length)
+{
+  struct file *file = regular_file (fd);
+  if (file == NULL || (off_t) offset < 0 || (off_t) length < 0)
+    {
+      return -1;
+    }
+  thread_lock_file ();
+  bool success = file_punch (file, offset, length);
+  thread_release_file ();
+  return success ? 0 : -1;
+}
+
+/* System call sync. */
+void
+syscall_sync (void)
+{
+  thread_lock_file ();
+  filesys_sync ();
+  thread_release_file ();
 }
 
 /* System call seek. */
 void
 syscall_seek (int fd, unsigned position)
 {
-  struct list_elem *e;
-
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
     {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-      if (f->fd == fd)
-        {
-          thread_lock_file ();
-          file_seek (f->file_address, position);
-          thread_release_file ();
-          return;
-        }
+      return;
     }
-  return -1;
+  thread_lock_file ();
+  file_seek (f->file_address, position);
+  thread_release_file ();
 }
 
 /* System call tell. */
 unsigned
 syscall_tell (int fd)
 {
-    if (list_empty (&(thread_current ()->file_descriptors)))
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
     {
       return -1;
     }
-
-  struct list_elem *e;
-
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
-    {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-      if (f->fd == fd)
-        {
-          thread_lock_file ();
-          int ret = file_tell (f->file_address);
-          thread_release_file ();
-          return ret;
-        }
-    }
-  return -1;
+  thread_lock_file ();
+  int ret = file_tell (f->file_address);
+  thread_release_file ();
+  return ret;
 }
 
 /* System call close */
 void
 syscall_close (int fd)
 {
-  if (list_empty (&(thread_current ()->file_descriptors)))
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
     {
       syscall_exit (-1);
     }
+  fd_remove (fd);
+  fd_release (f);
+}
 
-  struct list_elem *e;
+/* Closes every file the current process still has open and frees
+   its descriptor table.  Called when the process exits. */
+void
+syscall_close_all (void)
+{
+  struct thread *cur = thread_current ();
+  int fd;
+
+  for (fd = FD_MIN; fd < cur->fd_cnt; fd++)
+    if (cur->fd_table[fd] != NULL)
+      fd_release (cur->fd_table[fd]);
+  free (cur->fd_table);
+  cur->fd_table = NULL;
+  cur->fd_cnt = 0;
+  cur->fd_min_free = FD_MIN;
+}
+
+/* Returns the current process's descriptor for FD, or a null
+   pointer if FD is not open.  Takes constant time no matter how
+   many files the process has open. */
+static struct file_descriptor *
+fd_lookup (int fd)
+{
+  struct thread *cur = thread_current ();
+
+  if (fd < FD_MIN || fd >= cur->fd_cnt)
+    return NULL;
+  return cur->fd_table[fd];
+}
+
+/* Stores FILE_DES in the lowest free slot of the current
+   process's descriptor table, doubling the table first if it is
+   full, and sets FILE_DES->fd.  Returns the new fd, or -1 if
+   memory is exhausted. */
+static int
+fd_install (struct file_descriptor *file_des)
+{
+  struct thread *cur = thread_current ();
+  int fd;
+
+  for (fd = cur->fd_min_free; fd < cur->fd_cnt; fd++)
+    if (cur->fd_table[fd] == NULL)
+      break;
 
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
+  if (fd >= cur->fd_cnt)
     {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-      if (f->fd == fd)
-        {
-          struct file *file_addr = f->file_address;
-          list_remove (&f->file_elem);
-          if (inode_is_dir (file_get_inode (f->file_address)))
-            {
-              dir_close (f->dir);
-            }
-          /* remove all */
-          thread_lock_file ();
-          file_close (file_addr);
-          thread_release_file ();
-          free (f);
-          return ;
-        }
+      int new_cnt = cur->fd_cnt > 0 ? cur->fd_cnt * 2 : FD_TABLE_INIT;
+      struct file_descriptor **new_table;
+
+      while (new_cnt <= fd)
+        new_cnt *= 2;
+      new_table = realloc (cur->fd_table, new_cnt * sizeof *new_table);
+      if (new_table == NULL)
+        return -1;
+      memset (new_table + cur->fd_cnt, 0,
+              (new_cnt - cur->fd_cnt) * sizeof *new_table);
+      cur->fd_table = new_table;
+      cur->fd_cnt = new_cnt;
     }
-    syscall_exit(-1);
+
+  file_des->fd = fd;
+  cur->fd_table[fd] = file_des;
+  cur->fd_min_free = fd + 1;
+  return fd;
 }
 
-void
-syscall_check_addr (void *ptr, struct intr_frame *f UNUSED)
+/* Clears slot FD in the current process's descriptor table so
+   that the next open can reuse it. */
+static void
+fd_remove (int fd)
 {
-  if (!is_user_vaddr (ptr) || !ptr || !is_user_vaddr (ptr+1))
+  struct thread *cur = thread_current ();
+
+  ASSERT (fd >= FD_MIN && fd < cur->fd_cnt);
+  cur->fd_table[fd] = NULL;
+  if (fd < cur->fd_min_free)
+    cur->fd_min_free = fd;
+}
+
+/* Closes the file behind descriptor F and frees F. */
+static void
+fd_release (struct file_descriptor *f)
+{
+  struct file *file_addr = f->file_address;
+  if (inode_is_dir (file_get_inode (f->file_address)))
     {
-      f->eax = -1;
-      syscall_exit (-1);
-      return 0;
+      dir_close (f->dir);
+    }
+  /* remove all */
+  thread_lock_file ();
+  file_close (file_addr);
+  thread_release_file ();
+  kmem_cache_free (fd_cache, f);
+}
+
+/* Returns true if the SIZE bytes of user memory at UADDR are
+   all mapped in the current process (and writable, if WRITE is
+   true).  The page table is consulted once per page spanned by
+   the range, not once per byte. */
+static bool
+user_range_ok (const void *uaddr, size_t size, bool write)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  const uint8_t *start = uaddr;
+  const uint8_t *last = start + size - 1;
+  const uint8_t *page;
+
+  if (size == 0)
+    return true;
+  if (start == NULL || last < start || !is_user_vaddr (last))
+    return false;
+
+  for (page = pg_round_down (start); page <= last; page += PGSIZE)
+    {
+      if (pagedir_get_page (pd, page) == NULL)
+        return false;
+      if (write && !pagedir_is_writable (pd, page))
+        return false;
+    }
+  return true;
+}
+
+/* Returns true if USTR is a null-terminated string lying
+   entirely within the current process's mapped memory.  Each
+   page is looked up once, then scanned for the terminator. */
+static bool
+user_string_ok (const char *ustr)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  const char *p = ustr;
+
+  if (p == NULL)
+    return false;
+  for (;;)
+    {
+      const char *page_end;
+
+      if (!is_user_vaddr (p) || pagedir_get_page (pd, p) == NULL)
+        return false;
+      page_end = (const char *) pg_round_down (p) + PGSIZE;
+      for (; p < page_end; p++)
+        if (*p == '\0')
+          return true;
     }
-  /* check page_ptr */
-  void *page_ptr = pagedir_get_page (thread_current ()->pagedir,ptr);
-  if (!page_ptr)
+}
+
+/* Copies SIZE bytes from user address USRC into kernel buffer
+   DST.  Returns false, copying nothing, if any part of the
+   source is not mapped in the current process. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  if (!user_range_ok (usrc, size, false))
+    return false;
+  memcpy (dst, usrc, size);
+  return true;
+}
+
+/* Kills the current process unless the SIZE-byte user buffer at
+   PTR is mapped (and writable, if WRITE is true).  Used for
+   buffers the kernel then accesses in place: user pages are never
+   paged out, so once checked they stay mapped for the rest of the
+   system call, and reads go straight into them without a kernel
+   bounce buffer. */
+void
+syscall_check_buffer (const void *ptr, struct intr_frame *f, unsigned size,
+                      bool write)
+{
+  if (!user_range_ok (ptr, size, write))
     {
       f->eax = -1;
       syscall_exit (-1);
     }
-  
 }
 
+/* Kills the current process unless STR is a valid user
+   string. */
 void
-syscall_check_buffer (void *ptr, struct intr_frame *f UNUSED, unsigned size)
+syscall_check_string (const char *str, struct intr_frame *f)
 {
-  unsigned i = 0;
-  for (i;i<size;i++)
+  if (!user_string_ok (str))
     {
-      void *p = ptr + i;
-      syscall_check_addr (p, f);
+      f->eax = -1;
+      syscall_exit (-1);
     }
 }
 
@@ -591,36 +1125,32 @@ syscall_mkdir (const char * dir)
 bool 
 syscall_readdir (int fd, char * name)
 {
-  if (list_empty (&(thread_current ()->file_descriptors)))
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL || !inode_is_dir (file_get_inode (f->file_address)))
     {
       syscall_exit (-1);
     }
+  // printf ("reach here\n");
+  // printf("fd is %d, name is %s\n", fd, name);
+  return dir_readdir (f->dir, name);
+}
 
-  struct list_elem *e;
-
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
+/* System call getdents.  Reads up to CNT entries of directory FD
+   into ENTS, continuing where the last readdir() or getdents()
+   left off.  Returns the number of entries read, 0 at the end of
+   the directory, or -1 if FD is not an open directory. */
+int
+syscall_getdents (int fd, struct dirent *ents, int cnt)
+{
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL || !inode_is_dir (file_get_inode (f->file_address)))
     {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-      if (f->fd == fd)
-        {
-          // printf ("reach here\n");
-          // printf("fd is %d, name is %s\n", fd, name);
-          // if (strcmp (name, "fs.tar") == 0)
-          //   {
-          //     syscall_remove (f->file_address);
-          //     printf ("fs.tar is removed\n");
-          //     return false;
-          //   }
-          if (inode_is_dir (file_get_inode (f->file_address)))
-            {
-              // printf ("reach here\n");
-              return dir_readdir (f->dir, name);
-            }
-        }
+      return -1;
     }
-    syscall_exit(-1);
+  thread_lock_file ();
+  int ret = dir_getdents (f->dir, ents, cnt);
+  thread_release_file ();
+  return ret;
 }
 
 // bool 
@@ -632,56 +1162,21 @@ syscall_readdir (int fd, char * name)
 int 
 syscall_inumber (int fd)
 {
-  if (list_empty (&(thread_current ()->file_descriptors)))
-  {
-    syscall_exit (-1);
-  }
-
-  struct list_elem *e;
-
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
     {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-
-
-      if (f->fd == fd)
-        {
-          // printf ("the inumber of %d is %d\n", fd, inode_get_inumber (file_get_inode (f->file_address)));
-          if (fd == 2)
-            {
-              return 134;
-            }
-          return inode_get_inumber (file_get_inode (f->file_address));
-        }
+      syscall_exit (-1);
     }
-    syscall_exit(-1);
+  return inode_get_inumber (file_get_inode (f->file_address));
 }
 
 bool
 syscall_isdir (int fd)
 {
-  if (list_empty (&(thread_current ()->file_descriptors)))
-  {
-    syscall_exit (-1);
-  }
-
-  struct list_elem *e;
-
-  for (e = list_begin (&(thread_current ()->file_descriptors));\
-       e != list_end (&thread_current ()->file_descriptors);
-           e = list_next (e))
+  struct file_descriptor *f = fd_lookup (fd);
+  if (f == NULL)
     {
-      struct file_descriptor *f = list_entry (e, struct file_descriptor, file_elem);
-
-
-      if (f->fd == fd)
-        {
-          return inode_is_dir (file_get_inode (f->file_address));
-        }
+      syscall_exit (-1);
     }
-    syscall_exit(-1);
+  return inode_is_dir (file_get_inode (f->file_address));
 }
-
-